@@ -0,0 +1,107 @@
+// Counts the heap objects each engine allocates running the same scripts:
+// the tree-walker, which gives every scope an environment on the heap and
+// every function declaration a closure object, against the VM, which keeps
+// locals on its stack, moves only captured ones to the heap when their frame
+// exits, and needs no closure for a method or run-once function that
+// captures nothing.
+//
+// Usage: alloc_bench <path/to/interpreter> <script.lox>...
+//
+// Each script is run once per engine with `run --stats=FILE`, so the
+// interpreter has to be built with LOX_STATS on (the default).
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+extern char** environ;
+
+namespace {
+
+struct Counts {
+    unsigned long long objects = 0;
+    unsigned long long bytes = 0;
+};
+
+// Reads `"key": N` out of the stats JSON
+bool read_counter(const std::string& json, const std::string& key, unsigned long long& value) {
+    size_t at = json.find("\"" + key + "\": ");
+    if (at == std::string::npos) return false;
+    value = std::strtoull(json.c_str() + at + key.size() + 4, nullptr, 10);
+    return true;
+}
+
+bool run_script(const char* interpreter, const std::string& engine, const char* script,
+                posix_spawn_file_actions_t* actions, Counts& counts) {
+    char stats_path[] = "/tmp/alloc_bench_XXXXXX";
+    int fd = mkstemp(stats_path);
+    if (fd < 0) return false;
+    close(fd);
+
+    std::string engine_flag = "--engine=" + engine;
+    std::string stats_flag = std::string("--stats=") + stats_path;
+    char* args[] = {
+        const_cast<char*>(interpreter),
+        const_cast<char*>("run"),
+        engine_flag.data(),
+        stats_flag.data(),
+        const_cast<char*>(script),
+        nullptr,
+    };
+
+    pid_t pid;
+    int status;
+    bool ok = posix_spawn(&pid, interpreter, actions, nullptr, args, environ) == 0 &&
+              waitpid(pid, &status, 0) >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (ok) {
+        std::ifstream file(stats_path);
+        std::stringstream json;
+        json << file.rdbuf();
+        ok = read_counter(json.str(), "gc_objects_allocated", counts.objects) &&
+             read_counter(json.str(), "gc_bytes_allocated", counts.bytes);
+    }
+    unlink(stats_path);
+    return ok;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <interpreter> <script.lox>...\n", argv[0]);
+        return 1;
+    }
+    const char* interpreter = argv[1];
+
+    // The scripts' own output is not what's being measured
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    int status = 0;
+    std::printf("%-32s %12s %12s %12s %12s %8s\n", "script", "ast objects", "ast bytes", "vm objects",
+                "vm bytes", "ratio");
+    for (int i = 2; i < argc; i++) {
+        Counts ast;
+        Counts vm;
+        if (!run_script(interpreter, "ast", argv[i], &actions, ast) ||
+            !run_script(interpreter, "vm", argv[i], &actions, vm)) {
+            std::fprintf(stderr, "Failed to run %s (is --stats compiled in?)\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        double ratio = vm.objects == 0 ? 0.0 : static_cast<double>(ast.objects) / vm.objects;
+        std::printf("%-32s %12llu %12llu %12llu %12llu %7.1fx\n", argv[i], ast.objects, ast.bytes, vm.objects,
+                    vm.bytes, ratio);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    return status;
+}
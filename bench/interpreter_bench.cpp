@@ -0,0 +1,313 @@
+// Throughput benchmark for the tokenizer front end: file reading, scanning
+// and `tokenize` output formatting, over several synthetic corpora that
+// stress different paths through Scanner::scanToken.
+//
+// Usage: interpreter_bench [--size MB] [--warmup N] [--repeat N]
+//                          [--label TEXT] [--json FILE] [--baseline FILE]
+//
+// --baseline takes a JSON report from an earlier run (another commit or
+// build configuration) and adds a speedup column per corpus and phase.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "error.hpp"
+#include "file.hpp"
+#include "scanner.hpp"
+#include "token.hpp"
+
+namespace {
+
+struct Options {
+    size_t size = 4 << 20;
+    int warmup = 2;
+    int repeat = 7;
+    std::string label;
+    std::string json;
+    std::string baseline;
+};
+
+struct Corpus {
+    std::string name;
+    std::string source;
+};
+
+struct Result {
+    std::string corpus;
+    std::string phase;
+    size_t bytes;
+    size_t tokens;
+    double median_ns;
+    double min_ns;
+};
+
+// Each corpus is a stream of short fragments picked at random with a fixed
+// seed, so runs on different commits see byte-identical input
+std::string build_corpus(size_t size, const std::function<void(std::mt19937&, std::string&)>& fragment) {
+    std::mt19937 rng(42);
+    std::string source;
+    source.reserve(size + 256);
+    while (source.size() < size) fragment(rng, source);
+    return source;
+}
+
+std::string random_word(std::mt19937& rng, size_t min_length, size_t max_length) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyz_ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    std::uniform_int_distribution<size_t> length(min_length, max_length);
+    std::uniform_int_distribution<size_t> first(0, 52);
+    std::uniform_int_distribution<size_t> rest(0, sizeof(letters) - 2);
+    std::string word(length(rng), ' ');
+    word[0] = letters[first(rng)];
+    for (size_t i = 1; i < word.size(); i++) word[i] = letters[rest(rng)];
+    return word;
+}
+
+std::vector<Corpus> build_corpora(size_t size) {
+    std::vector<Corpus> corpora;
+
+    corpora.push_back({"identifiers", build_corpus(size, [](std::mt19937& rng, std::string& out) {
+        static const char* keywords[] = {"if", "else", "while", "for", "return", "true", "false"};
+        if (rng() % 5 == 0) out += keywords[rng() % 7];
+        else out += random_word(rng, 1, 16);
+        out += (rng() % 8 == 0) ? '\n' : ' ';
+    })});
+
+    corpora.push_back({"numbers", build_corpus(size, [](std::mt19937& rng, std::string& out) {
+        out += std::to_string(rng() % 100000);
+        if (rng() % 2 == 0) out += "." + std::to_string(rng() % 1000);
+        out += (rng() % 4 == 0) ? " + " : " ";
+    })});
+
+    corpora.push_back({"comments", build_corpus(size, [](std::mt19937& rng, std::string& out) {
+        out += "x = y; // ";
+        size_t words = 4 + rng() % 12;
+        for (size_t i = 0; i < words; i++) out += random_word(rng, 2, 10) + ' ';
+        out += '\n';
+    })});
+
+    corpora.push_back({"strings", build_corpus(size, [](std::mt19937& rng, std::string& out) {
+        out += "print \"";
+        size_t words = 20 + rng() % 200;
+        for (size_t i = 0; i < words; i++) out += random_word(rng, 1, 12) + ((rng() % 16 == 0) ? '\n' : ' ');
+        out += "\";\n";
+    })});
+
+    corpora.push_back({"errors", build_corpus(size, [](std::mt19937& rng, std::string& out) {
+        static const char junk[] = "@#$%^&|~`?:'\\";
+        out += random_word(rng, 1, 6);
+        out += ' ';
+        out += junk[rng() % (sizeof(junk) - 1)];
+        out += (rng() % 8 == 0) ? '\n' : ' ';
+    })});
+
+    return corpora;
+}
+
+// Runs `body` warmup + repeat times and returns the sorted timings in ns
+std::vector<double> measure(const Options& options, const std::function<void()>& body) {
+    std::vector<double> samples;
+    for (int i = 0; i < options.warmup + options.repeat; i++) {
+        auto started = std::chrono::steady_clock::now();
+        body();
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        if (i >= options.warmup) {
+            samples.push_back(std::chrono::duration<double, std::nano>(elapsed).count());
+        }
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples;
+}
+
+Result summarise(const std::string& corpus, const std::string& phase, size_t bytes, size_t tokens,
+                 const std::vector<double>& samples) {
+    return {corpus, phase, bytes, tokens, samples[samples.size() / 2], samples.front()};
+}
+
+// Scanner errors go to stderr; the error-dense corpus would otherwise spend
+// most of its time in the terminal. Returns the saved descriptor
+int silence_stderr() {
+    std::cerr.flush();
+    int saved = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDERR_FILENO);
+    close(null);
+    return saved;
+}
+
+void restore_stderr(int saved) {
+    std::cerr.flush();
+    dup2(saved, STDERR_FILENO);
+    close(saved);
+}
+
+std::vector<Result> run_corpus(const Options& options, const Corpus& corpus) {
+    std::vector<Result> results;
+    size_t bytes = corpus.source.size();
+
+    std::string path = "/tmp/interpreter_bench_" + corpus.name + ".lox";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << corpus.source;
+    }
+    size_t read_bytes = 0;
+    auto read_samples = measure(options, [&] {
+        read_bytes = read_file_contents(path).size();
+    });
+    std::remove(path.c_str());
+
+    size_t token_count = 0;
+    auto scan_samples = measure(options, [&] {
+        Scanner scanner(corpus.source);
+        token_count = scanner.scanTokens().size();
+    });
+
+    Scanner scanner(corpus.source);
+    std::vector<Token> tokens = scanner.scanTokens();
+    std::ostringstream out;
+    auto format_samples = measure(options, [&] {
+        out.str("");
+        for (const auto& token : tokens) out << token << '\n';
+    });
+
+    results.push_back(summarise(corpus.name, "read_file_contents", read_bytes, token_count, read_samples));
+    results.push_back(summarise(corpus.name, "scanTokens", bytes, token_count, scan_samples));
+    results.push_back(summarise(corpus.name, "format", bytes, token_count, format_samples));
+    return results;
+}
+
+void print_table(const std::vector<Result>& results) {
+    std::printf("%-12s %-20s %10s %10s %10s %12s %10s\n",
+                "corpus", "phase", "MB", "tokens", "MB/s", "Mtokens/s", "ns/token");
+    for (const auto& r : results) {
+        double seconds = r.median_ns / 1e9;
+        std::printf("%-12s %-20s %10.2f %10zu %10.1f %12.2f %10.2f\n",
+                    r.corpus.c_str(), r.phase.c_str(), r.bytes / 1e6, r.tokens,
+                    r.bytes / 1e6 / seconds, r.tokens / 1e6 / seconds, r.median_ns / r.tokens);
+    }
+}
+
+bool write_json(const std::string& path, const Options& options, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    if (!out.is_open()) return false;
+
+    out << "{\n  \"label\": \"" << options.label << "\",\n"
+        << "  \"warmup\": " << options.warmup << ",\n"
+        << "  \"repeat\": " << options.repeat << ",\n"
+        << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        double seconds = r.median_ns / 1e9;
+        out << "    {\"corpus\": \"" << r.corpus << "\", \"phase\": \"" << r.phase << "\""
+            << ", \"bytes\": " << r.bytes << ", \"tokens\": " << r.tokens
+            << ", \"median_ns\": " << r.median_ns << ", \"min_ns\": " << r.min_ns
+            << ", \"mb_per_s\": " << r.bytes / 1e6 / seconds
+            << ", \"tokens_per_s\": " << r.tokens / seconds
+            << ", \"ns_per_token\": " << r.median_ns / r.tokens << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+    return true;
+}
+
+// Pulls the string or number that follows `"key": ` out of one JSON line.
+// Only meant for the one-result-per-line files write_json produces
+std::string json_field(const std::string& line, const std::string& key) {
+    size_t at = line.find("\"" + key + "\": ");
+    if (at == std::string::npos) return "";
+    at += key.size() + 4;
+    if (line[at] == '"') {
+        size_t end = line.find('"', at + 1);
+        return line.substr(at + 1, end - at - 1);
+    }
+    size_t end = line.find_first_of(",}", at);
+    return line.substr(at, end - at);
+}
+
+// Maps "corpus/phase" to the median time recorded in an earlier report
+std::map<std::string, double> load_baseline(const std::string& path) {
+    std::map<std::string, double> medians;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        std::string corpus = json_field(line, "corpus");
+        if (corpus.empty()) continue;
+        medians[corpus + "/" + json_field(line, "phase")] = std::atof(json_field(line, "median_ns").c_str());
+    }
+    return medians;
+}
+
+bool print_comparison(const std::string& path, const std::vector<Result>& results) {
+    std::map<std::string, double> baseline = load_baseline(path);
+    if (baseline.empty()) return false;
+
+    std::printf("\n%-12s %-20s %14s %14s %9s\n", "corpus", "phase", "baseline MB/s", "MB/s", "speedup");
+    for (const auto& r : results) {
+        auto found = baseline.find(r.corpus + "/" + r.phase);
+        if (found == baseline.end() || found->second <= 0) continue;
+        std::printf("%-12s %-20s %14.1f %14.1f %8.2fx\n", r.corpus.c_str(), r.phase.c_str(),
+                    r.bytes * 1e3 / found->second,
+                    r.bytes * 1e3 / r.median_ns,
+                    found->second / r.median_ns);
+    }
+    return true;
+}
+
+bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        std::string value = argv[++i];
+        if (arg == "--size") options.size = static_cast<size_t>(std::atof(value.c_str()) * (1 << 20));
+        else if (arg == "--warmup") options.warmup = std::atoi(value.c_str());
+        else if (arg == "--repeat") options.repeat = std::atoi(value.c_str());
+        else if (arg == "--label") options.label = value;
+        else if (arg == "--json") options.json = value;
+        else if (arg == "--baseline") options.baseline = value;
+        else return false;
+    }
+    return options.size > 0 && options.warmup >= 0 && options.repeat > 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [--size MB] [--warmup N] [--repeat N] [--label TEXT] [--json FILE]"
+                  << " [--baseline FILE]" << std::endl;
+        return 1;
+    }
+
+    std::vector<Result> results;
+    for (const auto& corpus : build_corpora(options.size)) {
+        int saved = silence_stderr();
+        auto corpus_results = run_corpus(options, corpus);
+        restore_stderr(saved);
+        results.insert(results.end(), corpus_results.begin(), corpus_results.end());
+    }
+
+    print_table(results);
+    if (!options.baseline.empty() && !print_comparison(options.baseline, results)) {
+        std::cerr << "Cannot read baseline " << options.baseline << std::endl;
+        return 1;
+    }
+    if (!options.json.empty() && !write_json(options.json, options, results)) {
+        std::cerr << "Cannot write " << options.json << std::endl;
+        return 1;
+    }
+    return 0;
+}
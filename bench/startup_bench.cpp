@@ -0,0 +1,99 @@
+// Measures how long the interpreter takes to start, tokenize an empty file
+// and exit, by spawning it thousands of times and reporting percentiles.
+//
+// Usage: startup_bench <path/to/interpreter> [runs]
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+
+constexpr int WARMUP_RUNS = 50;
+
+// Returns the wall time of one spawn-to-reap cycle in microseconds,
+// or a negative value if the child could not be run
+double run_once(const char* interpreter, const char* input, posix_spawn_file_actions_t* actions) {
+    char* args[] = {
+        const_cast<char*>(interpreter),
+        const_cast<char*>("tokenize"),
+        const_cast<char*>(input),
+        nullptr,
+    };
+
+    auto started = std::chrono::steady_clock::now();
+    pid_t pid;
+    if (posix_spawn(&pid, interpreter, actions, nullptr, args, environ) != 0) return -1;
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return -1;
+    auto elapsed = std::chrono::steady_clock::now() - started;
+
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+double percentile(const std::vector<double>& sorted, double p) {
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[index];
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::fprintf(stderr, "Usage: %s <interpreter> [runs]\n", argv[0]);
+        return 1;
+    }
+    const char* interpreter = argv[1];
+    int runs = argc > 2 ? std::atoi(argv[2]) : 5000;
+    if (runs <= 0) {
+        std::fprintf(stderr, "runs must be positive\n");
+        return 1;
+    }
+
+    char input[] = "/tmp/startup_bench_XXXXXX.lox";
+    int fd = mkstemps(input, 4);
+    if (fd < 0) {
+        std::perror("mkstemps");
+        return 1;
+    }
+    close(fd);
+
+    // The interpreter's own output is not what's being measured
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    std::vector<double> samples;
+    samples.reserve(runs);
+    for (int i = 0; i < WARMUP_RUNS + runs; i++) {
+        double micros = run_once(interpreter, input, &actions);
+        if (micros < 0) {
+            std::fprintf(stderr, "Failed to run %s\n", interpreter);
+            unlink(input);
+            return 1;
+        }
+        if (i >= WARMUP_RUNS) samples.push_back(micros);
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    unlink(input);
+
+    std::sort(samples.begin(), samples.end());
+    std::printf("%s: %d runs on an empty file\n", interpreter, runs);
+    std::printf("  min %8.1f us\n", samples.front());
+    std::printf("  p50 %8.1f us\n", percentile(samples, 0.50));
+    std::printf("  p90 %8.1f us\n", percentile(samples, 0.90));
+    std::printf("  p99 %8.1f us\n", percentile(samples, 0.99));
+    std::printf("  max %8.1f us\n", samples.back());
+    return 0;
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# Builds the profile-guided, link-time optimised interpreter and compares it
+# with the plain -O3 release build:
+#
+#   1. release         plain build, the baseline
+#   2. pgo-instrument  instrumented build
+#   3. training        tokenize over bench/corpus plus a generated corpus
+#   4. pgo-optimized   rebuild with the profile, LTO and -O3
+#   5. comparison      interpreter_bench on both builds
+#
+# Set PGO_TRAINING_RUNS to change how often the bundled corpus is replayed.
+
+set -e # Exit early if any commands fail
+
+cd "$(dirname "$0")/.."
+runs=${PGO_TRAINING_RUNS:-20}
+
+cmake --preset release
+cmake --build --preset release
+
+rm -rf out/pgo-profile
+cmake --preset pgo-instrument
+cmake --build --preset pgo-instrument
+
+# tokenize exits with 65 on lexical errors, which is fine for training
+train() {
+    ./out/build/pgo/interpreter tokenize "$1" > /dev/null 2>&1 || [ $? -eq 65 ]
+}
+
+./out/build/release/loxgen --seed 2024 --size 8m -o out/pgo-training.lox
+i=0
+while [ $i -lt "$runs" ]; do
+    for file in bench/corpus/*.lox; do
+        train "$file"
+    done
+    i=$((i + 1))
+done
+train out/pgo-training.lox
+
+# Clang writes raw profiles that have to be merged first
+if ls out/pgo-profile/*.profraw > /dev/null 2>&1; then
+    llvm-profdata merge -output=out/pgo-profile/default.profdata out/pgo-profile/*.profraw
+fi
+
+cmake --preset pgo-optimized
+cmake --build --preset pgo-optimized
+
+./out/build/release/interpreter_bench --label release --json out/bench-release.json
+./out/build/pgo/interpreter_bench --label pgo+lto --json out/bench-pgo.json \
+    --baseline out/bench-release.json
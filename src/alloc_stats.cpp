@@ -0,0 +1,110 @@
+// Replacement global operator new/delete that count every heap allocation
+// for the --stats report. Compiled in only with LOX_ALLOC_STATS, since the
+// atomic counters tax every allocation in the process
+
+#include "stats.hpp"
+
+#ifdef LOX_ALLOC_STATS
+
+#include <malloc.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> frees{0};
+std::atomic<uint64_t> bytes_allocated{0};
+std::atomic<uint64_t> live_bytes{0};
+std::atomic<uint64_t> peak_live_bytes{0};
+
+// malloc_usable_size gives the same figure at allocation and at free, so
+// live bytes stay balanced even when delete isn't told the size
+void note_allocation(void* pointer) {
+    uint64_t size = malloc_usable_size(pointer);
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    bytes_allocated.fetch_add(size, std::memory_order_relaxed);
+    uint64_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    uint64_t peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+}
+
+void note_free(void* pointer) {
+    frees.fetch_add(1, std::memory_order_relaxed);
+    live_bytes.fetch_sub(malloc_usable_size(pointer), std::memory_order_relaxed);
+}
+
+void* allocate(std::size_t size) {
+    void* pointer = std::malloc(size == 0 ? 1 : size);
+    if (pointer) note_allocation(pointer);
+    return pointer;
+}
+
+void* allocate_aligned(std::size_t size, std::align_val_t alignment) {
+    std::size_t align = static_cast<std::size_t>(alignment);
+    void* pointer = std::aligned_alloc(align, (size + align - 1) / align * align);
+    if (pointer) note_allocation(pointer);
+    return pointer;
+}
+
+void release(void* pointer) {
+    if (!pointer) return;
+    note_free(pointer);
+    std::free(pointer);
+}
+
+}
+
+void* operator new(std::size_t size) {
+    if (void* pointer = allocate(size)) return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    if (void* pointer = allocate_aligned(size, alignment)) return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { release(pointer); }
+void operator delete[](void* pointer) noexcept { release(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { release(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { release(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { release(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { release(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { release(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { release(pointer); }
+
+AllocCounters alloc_counters() {
+    return {
+        allocations.load(std::memory_order_relaxed),
+        frees.load(std::memory_order_relaxed),
+        bytes_allocated.load(std::memory_order_relaxed),
+        peak_live_bytes.load(std::memory_order_relaxed),
+    };
+}
+
+#else
+
+AllocCounters alloc_counters() {
+    return {};
+}
+
+#endif
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "token.hpp"
+
+// The syntax tree is stored flat: every node is a small fixed-size struct
+// in one contiguous vector, and children are referred to by 32-bit index
+// rather than by pointer. Building a tree is a handful of push_backs into
+// pre-reserved storage, walking it stays within a few cache lines, and
+// freeing it is a single deallocation
+
+using NodeIndex = uint32_t;
+constexpr NodeIndex NO_NODE = std::numeric_limits<NodeIndex>::max();
+
+enum class NodeKind : uint8_t {
+    // Expressions
+    NUMBER,     // a:b = bit pattern of the double
+    STRING,     // token = the STRING token, whose literal is the value
+    TRUE, FALSE, NIL,
+    GROUPING,   // a = inner expression
+    UNARY,      // op, a = operand
+    BINARY,     // op, a = left, b = right
+    LOGICAL,    // op = AND/OR, a = left, b = right
+    VARIABLE,   // token = name
+    ASSIGN,     // token = name, a = value
+    CALL,       // token = closing paren, a = callee, b:c = argument list
+    GET,        // token = property name, a = object
+    SET,        // token = property name, a = object, b = value
+    THIS,       // token = `this`
+    SUPER,      // token = method name, a = token index of `super`
+
+    // Statements
+    PROGRAM,    // a:b = declaration list
+    EXPRESSION, // a = expression
+    PRINT,      // a = expression
+    VAR,        // token = name, a = initializer or NO_NODE
+    BLOCK,      // a:b = statement list
+    IF,         // a = condition, b = then branch, c = else branch or NO_NODE
+    WHILE,      // a = condition, b = body
+    FUNCTION,   // token = name, a:b = parameter token indices, c = body BLOCK
+    RETURN,     // token = `return`, a = value or NO_NODE
+    CLASS,      // token = name, a = superclass VARIABLE or NO_NODE, b:c = method FUNCTIONs
+};
+
+struct Node {
+    NodeKind  kind;
+    TokenType op = TokenType::END_OF_FILE;
+    uint32_t  token = 0;      // index into Ast::tokens, for lines and names
+    uint32_t  a = NO_NODE;
+    uint32_t  b = NO_NODE;
+    uint32_t  c = NO_NODE;
+};
+
+// Where a name lives at runtime, worked out by resolve(). A local is
+// `depth` environments out from the current one, at index `slot`; a global
+// has depth GLOBAL and `slot` is its index in the dense globals array.
+// The body BLOCK of a function and every other BLOCK instead record in
+// `slot` how many slots their scope needs
+struct Binding {
+    uint32_t depth = 0;
+    uint32_t slot = 0;
+};
+
+constexpr uint32_t GLOBAL = std::numeric_limits<uint32_t>::max();
+constexpr uint32_t NOT_IN_FRAME = std::numeric_limits<uint32_t>::max();
+
+struct Ast {
+    std::vector<Token> tokens;
+    std::vector<Node> nodes;
+    // Children of variable-arity nodes (call arguments, block statements,
+    // function parameters as token indices, ...) live here as
+    // runs of indices; the node stores where its run starts and how long it is
+    std::vector<NodeIndex> lists;
+    NodeIndex root = NO_NODE;
+    // One per node once resolved; only names, declarations and scopes use theirs
+    std::vector<Binding> bindings;
+    uint32_t globalCount = 0;
+    // One per node once find_frame_allocations() has run: for a CALL that
+    // constructs an instance which never leaves its block, the number of
+    // field slots to build it with in the block's frame; NOT_IN_FRAME for
+    // everything else
+    std::vector<uint32_t> frameFields;
+
+    const Node& operator[](NodeIndex index) const { return nodes[index]; }
+    Node& operator[](NodeIndex index) { return nodes[index]; }
+
+    const Token& token(const Node& node) const { return tokens[node.token]; }
+    int line(const Node& node) const { return tokens[node.token].line; }
+
+    std::span<const NodeIndex> list(uint32_t start, uint32_t count) const {
+        return {lists.data() + start, count};
+    }
+
+    NodeIndex add(const Node& node) {
+        nodes.push_back(node);
+        return static_cast<NodeIndex>(nodes.size() - 1);
+    }
+
+    static void setNumber(Node& node, double value) {
+        uint64_t bits = std::bit_cast<uint64_t>(value);
+        node.a = static_cast<uint32_t>(bits);
+        node.b = static_cast<uint32_t>(bits >> 32);
+    }
+
+    static double number(const Node& node) {
+        return std::bit_cast<double>(static_cast<uint64_t>(node.a) | static_cast<uint64_t>(node.b) << 32);
+    }
+};
+
+// Calls visit(NodeIndex) for each child of `node` that is itself a node,
+// in evaluation order. Parameter lists hold token indices, not nodes, and
+// are skipped
+template <typename Visit>
+void for_each_child(const Ast& ast, const Node& node, Visit&& visit) {
+    auto visitIf = [&](NodeIndex child) {
+        if (child != NO_NODE) visit(child);
+    };
+    switch (node.kind) {
+        case NodeKind::GROUPING:
+        case NodeKind::UNARY:
+        case NodeKind::ASSIGN:
+        case NodeKind::GET:
+        case NodeKind::EXPRESSION:
+        case NodeKind::PRINT:
+        case NodeKind::VAR:
+        case NodeKind::RETURN:
+            visitIf(node.a);
+            break;
+        case NodeKind::BINARY:
+        case NodeKind::LOGICAL:
+        case NodeKind::SET:
+        case NodeKind::WHILE:
+            visitIf(node.a);
+            visitIf(node.b);
+            break;
+        case NodeKind::IF:
+            visitIf(node.a);
+            visitIf(node.b);
+            visitIf(node.c);
+            break;
+        case NodeKind::CALL:
+            visitIf(node.a);
+            for (NodeIndex argument : ast.list(node.b, node.c)) visit(argument);
+            break;
+        case NodeKind::PROGRAM:
+        case NodeKind::BLOCK:
+            for (NodeIndex statement : ast.list(node.a, node.b)) visit(statement);
+            break;
+        case NodeKind::FUNCTION:
+            visitIf(node.c);
+            break;
+        case NodeKind::CLASS:
+            visitIf(node.a);
+            for (NodeIndex method : ast.list(node.b, node.c)) visit(method);
+            break;
+        default:
+            break;
+    }
+}
+
+// Renders the tree rooted at `index` in the parenthesised prefix form the
+// `parse` command prints, e.g. (* (group (+ 1.0 2.0)) 3.0)
+std::string print_ast(const Ast& ast, NodeIndex index);
+
+// Formats a number literal the way `parse` shows it: always with a
+// fractional part, so 42 prints as 42.0
+std::string format_number_literal(double value);
@@ -0,0 +1,86 @@
+#include <charconv>
+
+#include "ast.hpp"
+
+std::string format_number_literal(double value) {
+    char buffer[32];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    std::string text(buffer, result.ptr);
+    if (text.find_first_of(".en") == std::string::npos) text += ".0";
+    return text;
+}
+
+namespace {
+
+void print_node(const Ast& ast, NodeIndex index, std::string& out);
+
+void parenthesize(const Ast& ast, std::string_view name, std::initializer_list<NodeIndex> children,
+                  std::string& out) {
+    out += '(';
+    out += name;
+    for (NodeIndex child : children) {
+        out += ' ';
+        print_node(ast, child, out);
+    }
+    out += ')';
+}
+
+void print_node(const Ast& ast, NodeIndex index, std::string& out) {
+    const Node& node = ast[index];
+    const Token& token = ast.token(node);
+    switch (node.kind) {
+        case NodeKind::NUMBER: out += format_number_literal(Ast::number(node)); break;
+        case NodeKind::STRING: out += token.literal; break;
+        case NodeKind::TRUE: out += "true"; break;
+        case NodeKind::FALSE: out += "false"; break;
+        case NodeKind::NIL: out += "nil"; break;
+        case NodeKind::GROUPING: parenthesize(ast, "group", {node.a}, out); break;
+        case NodeKind::UNARY:
+        case NodeKind::BINARY:
+        case NodeKind::LOGICAL:
+            if (node.b == NO_NODE) parenthesize(ast, token.lexeme, {node.a}, out);
+            else parenthesize(ast, token.lexeme, {node.a, node.b}, out);
+            break;
+        case NodeKind::VARIABLE: out += token.lexeme; break;
+        case NodeKind::ASSIGN:
+            out += "(= " + token.lexeme + ' ';
+            print_node(ast, node.a, out);
+            out += ')';
+            break;
+        case NodeKind::CALL:
+            out += "(call ";
+            print_node(ast, node.a, out);
+            for (NodeIndex argument : ast.list(node.b, node.c)) {
+                out += ' ';
+                print_node(ast, argument, out);
+            }
+            out += ')';
+            break;
+        case NodeKind::GET:
+            out += "(. ";
+            print_node(ast, node.a, out);
+            out += ' ' + token.lexeme + ')';
+            break;
+        case NodeKind::SET:
+            out += "(= (. ";
+            print_node(ast, node.a, out);
+            out += ' ' + token.lexeme + ") ";
+            print_node(ast, node.b, out);
+            out += ')';
+            break;
+        case NodeKind::THIS: out += "this"; break;
+        case NodeKind::SUPER: out += "(super " + token.lexeme + ')'; break;
+        default:
+            // Statements have no expression syntax to print
+            out += "<statement>";
+            break;
+    }
+}
+
+}
+
+std::string print_ast(const Ast& ast, NodeIndex index) {
+    std::string out;
+    print_node(ast, index, out);
+    return out;
+}
@@ -0,0 +1,365 @@
+#include "bytecode_cache.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+#include "chunk.hpp"
+#include "natives.hpp"
+
+namespace {
+
+// Bump whenever the encoding of an instruction's operands or of this file
+// changes, or the compiler starts emitting different code for the same
+// source. Adding, removing or reordering opcodes changes the fingerprint
+// below on its own
+constexpr uint32_t FORMAT_VERSION = 2;
+constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+#define LOX_OPCODE_STRING(name) #name " "
+constexpr std::string_view OPCODE_LIST = LOX_OPCODES(LOX_OPCODE_STRING);
+#undef LOX_OPCODE_STRING
+
+// Functions nested deeper than this can't have come from the compiler,
+// whose own recursion gives out long before
+constexpr uint32_t MAX_NESTING = 1024;
+
+enum class ConstantTag : uint8_t { NUMBER, STRING, FUNCTION };
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint64_t opcodes;      // hash of the opcode list the code was compiled against
+    uint64_t sourceHash;
+    uint64_t payloadSize;
+    uint64_t payloadHash;  // catches a file damaged after it was written
+};
+
+// FNV-1a's multiply taken a word at a time, with a rotation so the high
+// bits a multiply leaves behind feed back into the low ones. Byte at a time
+// it was a third of the time a cached run spent loading
+uint64_t hash_bytes(std::string_view bytes) {
+    constexpr uint64_t PRIME = 1099511628211ull;
+    uint64_t hash = 14695981039346656037ull ^ bytes.size();
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, bytes.data() + i, sizeof(word));
+        hash = std::rotl((hash ^ word) * PRIME, 31);
+    }
+    for (; i < bytes.size(); i++) {
+        hash = std::rotl((hash ^ static_cast<uint8_t>(bytes[i])) * PRIME, 31);
+    }
+    return hash;
+}
+
+// Everything is written in the machine's own byte order: a cache is only
+// ever read back by the interpreter that wrote it.
+//
+// Every string (global names, function names and string constants) goes
+// in a table at the front and is referred to by its index, so a name used
+// all over the script is stored, and interned on loading, only once
+class Writer {
+public:
+    std::string bytes;
+    std::vector<ObjString*> strings;
+
+    template <typename T>
+    void put(T value) {
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Strings are interned, so equal strings are the same object
+    void string(ObjString* string) {
+        auto [entry, added] = stringIndex.try_emplace(string, static_cast<uint32_t>(strings.size()));
+        if (added) strings.push_back(string);
+        put(entry->second);
+    }
+
+    void function(const ObjFunction* function) {
+        put(static_cast<uint32_t>(function->arity));
+        put(static_cast<uint32_t>(function->upvalueCount));
+        put(static_cast<uint8_t>(function->name != nullptr));
+        if (function->name != nullptr) string(function->name);
+
+        const Chunk& chunk = function->chunk;
+        put(static_cast<uint32_t>(chunk.code.size()));
+        bytes.append(reinterpret_cast<const char*>(chunk.code.data()), chunk.code.size());
+        lines(chunk.lines);
+        put(static_cast<uint32_t>(chunk.caches.size()));
+
+        put(static_cast<uint32_t>(chunk.constants.size()));
+        for (Value constant : chunk.constants) {
+            if (constant.isNumber()) {
+                put(ConstantTag::NUMBER);
+                put(constant.asNumber());
+            }
+            else if (is_obj_type(constant, ObjType::STRING)) {
+                put(ConstantTag::STRING);
+                string(as_string(constant));
+            }
+            else {
+                put(ConstantTag::FUNCTION);
+                this->function(static_cast<const ObjFunction*>(constant.asObject()));
+            }
+        }
+    }
+
+private:
+    std::unordered_map<ObjString*, uint32_t> stringIndex;
+
+    // One line per byte of code is mostly long runs of the same line, so
+    // it is stored as (line, count) runs
+    void lines(const std::vector<int>& lines) {
+        size_t runsAt = bytes.size();
+        put(uint32_t{0});
+        uint32_t runs = 0;
+        for (size_t i = 0; i < lines.size();) {
+            size_t end = i;
+            while (end < lines.size() && lines[end] == lines[i]) end++;
+            put(static_cast<int32_t>(lines[i]));
+            put(static_cast<uint32_t>(end - i));
+            runs++;
+            i = end;
+        }
+        std::memcpy(bytes.data() + runsAt, &runs, sizeof(runs));
+    }
+};
+
+// Reads from the mapped file. Running off the end or finding something the
+// writer never writes clears `ok`; the caller checks it once at the end
+class Reader {
+public:
+    Reader(const char* at, const char* end, std::vector<Obj*>& made) : at(at), end(end), made(made) {}
+
+    std::vector<ObjString*> strings;
+
+    bool ok = true;
+
+    template <typename T>
+    T get() {
+        T value{};
+        if (static_cast<size_t>(end - at) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, at, sizeof(T));
+        at += sizeof(T);
+        return value;
+    }
+
+    std::string_view bytes(size_t count) {
+        if (static_cast<size_t>(end - at) < count) {
+            ok = false;
+            return {};
+        }
+        std::string_view view(at, count);
+        at += count;
+        return view;
+    }
+
+    void stringTable() {
+        uint32_t count = get<uint32_t>();
+        // Each string takes at least its length
+        if (count > static_cast<size_t>(end - at) / sizeof(uint32_t)) ok = false;
+        if (!ok) return;
+        strings.reserve(count);
+        for (uint32_t i = 0; i < count && ok; i++) {
+            std::string_view chars = bytes(get<uint32_t>());
+            if (!ok) return;
+            ObjString* string = heap.copyString(chars);
+            made.push_back(string);
+            strings.push_back(string);
+        }
+    }
+
+    ObjString* string() {
+        uint32_t index = get<uint32_t>();
+        if (index >= strings.size()) ok = false;
+        return ok ? strings[index] : nullptr;
+    }
+
+    ObjFunction* function(uint32_t depth) {
+        if (depth > MAX_NESTING) ok = false;
+        if (!ok) return nullptr;
+
+        auto* function = heap.make<ObjFunction>();
+        made.push_back(function);
+        function->arity = static_cast<int>(get<uint32_t>());
+        function->upvalueCount = static_cast<int>(get<uint32_t>());
+        if (get<uint8_t>() != 0) function->name = string();
+
+        Chunk& chunk = function->chunk;
+        std::string_view code = bytes(get<uint32_t>());
+        chunk.code.assign(code.begin(), code.end());
+        uint32_t runs = get<uint32_t>();
+        for (uint32_t i = 0; i < runs && ok; i++) {
+            int line = get<int32_t>();
+            uint32_t count = get<uint32_t>();
+            if (count > chunk.code.size() - chunk.lines.size()) ok = false;
+            else chunk.lines.insert(chunk.lines.end(), count, line);
+        }
+        if (chunk.lines.size() != chunk.code.size()) ok = false;
+        uint32_t caches = get<uint32_t>();
+        if (caches > chunk.code.size()) ok = false;
+        if (ok) chunk.caches.resize(caches);
+
+        uint32_t constants = get<uint32_t>();
+        for (uint32_t i = 0; i < constants && ok; i++) {
+            switch (get<ConstantTag>()) {
+                case ConstantTag::NUMBER:
+                    chunk.addConstant(Value::number(get<double>()));
+                    break;
+                case ConstantTag::STRING:
+                    if (ObjString* string = this->string()) chunk.addConstant(Value::object(string));
+                    break;
+                case ConstantTag::FUNCTION:
+                    if (ObjFunction* nested = this->function(depth + 1)) chunk.addConstant(Value::object(nested));
+                    break;
+                default:
+                    ok = false;
+            }
+        }
+        return ok ? function : nullptr;
+    }
+
+    bool atEnd() const { return at == end; }
+
+private:
+    const char* at;
+    const char* end;
+    std::vector<Obj*>& made;
+};
+
+// The file mapped read-only for as long as it's being loaded
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void* mapped = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED) {
+                data = static_cast<const char*>(mapped);
+                size = static_cast<size_t>(info.st_size);
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data != nullptr) munmap(const_cast<char*>(data), size);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+}
+
+uint64_t hash_source(std::string_view source) {
+    return hash_bytes(source);
+}
+
+std::string bytecode_cache_path(const std::string& script_path) {
+    return script_path + "c";
+}
+
+bool save_bytecode(const std::string& path, uint64_t source_hash, ObjFunction* script,
+                   const std::vector<ObjString*>& globals) {
+    Writer body;
+    body.put(static_cast<uint32_t>(globals.size()));
+    for (ObjString* name : globals) {
+        body.string(name);
+    }
+    body.function(script);
+
+    Writer payload;
+    payload.put(static_cast<uint32_t>(body.strings.size()));
+    for (ObjString* string : body.strings) {
+        payload.put(string->length);
+        payload.bytes.append(string->view());
+    }
+    payload.bytes.append(body.bytes);
+
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.opcodes = hash_bytes(OPCODE_LIST);
+    header.sourceHash = source_hash;
+    header.payloadSize = payload.bytes.size();
+    header.payloadHash = hash_bytes(payload.bytes);
+
+    std::string temporary = path + ".tmp." + std::to_string(getpid());
+    std::FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (!out) return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, out) == 1 &&
+                   std::fwrite(payload.bytes.data(), 1, payload.bytes.size(), out) == payload.bytes.size();
+    if (std::fclose(out) != 0 || !written || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+CachedScript::CachedScript() {
+    heap.addRoots(this);
+}
+
+CachedScript::~CachedScript() {
+    heap.removeRoots(this);
+}
+
+void CachedScript::markRoots(Heap& heap) {
+    heap.markObject(function);
+    for (ObjString* name : globals) {
+        heap.markObject(name);
+    }
+    for (Obj* object : loading) {
+        heap.markObject(object);
+    }
+}
+
+bool CachedScript::load(const std::string& path, uint64_t source_hash) {
+    MappedFile file(path);
+    Header header;
+    if (file.size < sizeof(header)) return false;
+    std::memcpy(&header, file.data, sizeof(header));
+    std::string_view payload(file.data + sizeof(header), file.size - sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION ||
+        header.opcodes != hash_bytes(OPCODE_LIST) || header.sourceHash != source_hash ||
+        header.payloadSize != payload.size() || header.payloadHash != hash_bytes(payload)) {
+        return false;
+    }
+
+    Reader reader(payload.data(), payload.data() + payload.size(), loading);
+    reader.stringTable();
+    // Global indices in the code assume the natives this build defines
+    uint32_t globalCount = reader.get<uint32_t>();
+    std::span<const NativeDef> builtins = natives();
+    for (uint32_t i = 0; i < globalCount && reader.ok; i++) {
+        ObjString* name = reader.string();
+        if (i < builtins.size() && reader.ok && name->view() != builtins[i].name) reader.ok = false;
+        globals.push_back(name);
+    }
+    if (globalCount < builtins.size()) reader.ok = false;
+    ObjFunction* loaded = reader.function(0);
+
+    loading.clear();
+    if (!reader.ok || !reader.atEnd()) {
+        globals.clear();
+        return false;
+    }
+    function = loaded;
+    return true;
+}
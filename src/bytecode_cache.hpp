@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "object.hpp"
+
+// Compiled scripts saved next to their source (`script.lox` ->
+// `script.loxc`) so later runs of an unchanged script skip scanning and
+// compiling. The file holds the script's function with every nested
+// function prototype, constant, line table and inline cache count, plus
+// the global names the bytecode's indices refer to.
+//
+// It is keyed by a hash of the source and stamped with a format version
+// and a fingerprint of the opcode list, so an edited script or a differently
+// built interpreter just misses and recompiles. A file that is truncated
+// or doesn't match its own checksum misses the same way
+
+// A 64-bit hash of the whole source, the key a cache file must match
+uint64_t hash_source(std::string_view source);
+
+std::string bytecode_cache_path(const std::string& script_path);
+
+// Writes the cache atomically (a temporary file renamed over the old one),
+// so a run that reads it at the same time sees the old file or the new one.
+// Returns false if it couldn't, which only costs the next run a compile
+bool save_bytecode(const std::string& path, uint64_t source_hash, ObjFunction* script,
+                   const std::vector<ObjString*>& globals);
+
+// A script loaded from a cache file. The file is mapped rather than read,
+// and its objects are rooted for as long as this lives, like a Compiler's
+class CachedScript : public GcRoots {
+public:
+    CachedScript();
+    ~CachedScript();
+
+    CachedScript(const CachedScript&) = delete;
+    CachedScript& operator=(const CachedScript&) = delete;
+
+    // Returns false if there is no usable cache for this source
+    bool load(const std::string& path, uint64_t source_hash);
+
+    ObjFunction* script() const { return function; }
+    const std::vector<ObjString*>& globalNames() const { return globals; }
+
+    void markRoots(Heap& heap) override;
+
+private:
+    ObjFunction* function = nullptr;
+    std::vector<ObjString*> globals;
+    // Everything made so far while loading, until `function` holds it all
+    std::vector<Obj*> loading;
+};
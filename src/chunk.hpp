@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "value.hpp"
+
+// Bytecode for the VM engine. Each instruction is a one-byte opcode
+// followed by its operands; constant, name and jump operands are 16 bits
+// (big-endian), local, upvalue and argument-count operands are 8 bits.
+// Property accesses also carry the index of their PropertyCache.
+//
+// The list is an X-macro so the enum, the VM's computed-goto table and
+// opcode_name() are generated from this one place and can never disagree
+// about the numbering. The compiler never emits the superinstructions at the
+// end (see optimize_bytecode()), and the quickened forms of ADD only ever
+// come from the VM rewriting the code as it runs
+#define LOX_OPCODES(X) \
+    X(CONSTANT)        /* u16 constant */                        \
+    X(NIL)                                                       \
+    X(TRUE)                                                      \
+    X(FALSE)                                                     \
+    X(POP)                                                       \
+    X(GET_LOCAL)       /* u8 slot */                             \
+    X(SET_LOCAL)       /* u8 slot */                             \
+    X(GET_GLOBAL)      /* u16 global index */                    \
+    X(DEFINE_GLOBAL)   /* u16 global index */                    \
+    X(SET_GLOBAL)      /* u16 global index */                    \
+    X(GET_UPVALUE)     /* u8 index */                            \
+    X(SET_UPVALUE)     /* u8 index */                            \
+    X(GET_PROPERTY)    /* u16 name, u16 cache */                 \
+    X(SET_PROPERTY)    /* u16 name, u16 cache */                 \
+    X(GET_SUPER)       /* u16 name */                            \
+    X(EQUAL)                                                     \
+    X(NOT_EQUAL)                                                 \
+    X(GREATER)                                                   \
+    X(GREATER_EQUAL)                                             \
+    X(LESS)                                                      \
+    X(LESS_EQUAL)                                                \
+    X(ADD)                                                       \
+    X(SUBTRACT)                                                  \
+    X(MULTIPLY)                                                  \
+    X(DIVIDE)                                                    \
+    X(NOT)                                                       \
+    X(NEGATE)                                                    \
+    X(PRINT)                                                     \
+    X(JUMP)            /* u16 forward offset */                  \
+    X(JUMP_IF_FALSE)   /* u16 forward offset, leaves condition */ \
+    X(LOOP)            /* u16 backward offset */                 \
+    X(CALL)            /* u8 argument count */                   \
+    X(INVOKE)          /* u16 name, u8 argument count, u16 cache */ \
+    X(SUPER_INVOKE)    /* u16 name, u8 argument count */         \
+    X(CLOSURE)         /* u16 function, then u8 isLocal + u8 index per upvalue */ \
+    X(CLOSE_UPVALUE)                                             \
+    X(RETURN)                                                    \
+    X(CLASS)           /* u16 name */                            \
+    X(INHERIT)                                                   \
+    X(METHOD)          /* u16 name */                            \
+    /* Superinstructions */                                      \
+    X(GET_LOCAL_2)     /* u8 slot, u8 slot */                    \
+    X(GET_LOCAL_CONSTANT) /* u8 slot, u16 constant */            \
+    X(SET_LOCAL_POP)   /* u8 slot */                             \
+    X(SET_PROPERTY_POP) /* u16 name, u16 cache */                \
+    X(ADD_CONSTANT_TO_LOCAL) /* u8 slot, u16 constant */         \
+    X(POP_JUMP_IF_FALSE) /* u16 forward offset, pops condition */ \
+    X(LESS_JUMP_IF_FALSE) /* u16 forward offset */               \
+    X(LESS_EQUAL_JUMP_IF_FALSE) /* u16 forward offset */         \
+    X(GREATER_JUMP_IF_FALSE) /* u16 forward offset */            \
+    X(GREATER_EQUAL_JUMP_IF_FALSE) /* u16 forward offset */    \
+    /* What an ADD rewrites itself to once it has run */         \
+    X(ADD_NUM)                                                   \
+    X(ADD_STR)                                                   \
+    X(ADD_ANY)
+
+enum class OpCode : uint8_t {
+#define LOX_OPCODE_ENUM(name) name,
+    LOX_OPCODES(LOX_OPCODE_ENUM)
+#undef LOX_OPCODE_ENUM
+};
+
+#define LOX_OPCODE_ONE(name) +1
+constexpr size_t OPCODE_COUNT = 0 LOX_OPCODES(LOX_OPCODE_ONE);
+#undef LOX_OPCODE_ONE
+
+inline const char* opcode_name(OpCode op) {
+    static constexpr const char* names[] = {
+#define LOX_OPCODE_NAME(name) #name,
+        LOX_OPCODES(LOX_OPCODE_NAME)
+#undef LOX_OPCODE_NAME
+    };
+    return names[static_cast<size_t>(op)];
+}
+
+struct Obj;
+struct ObjShape;
+
+// What one GET_PROPERTY, SET_PROPERTY or INVOKE instruction found when it
+// last looked the property up, keyed by the receiver's shape (which also
+// fixes its class, so its methods too). A site that only ever sees one
+// shape hits the first entry; one that sees up to MAX_ENTRIES shapes
+// checks each in turn. A site that sees more is megamorphic: it empties
+// its cache and does the full lookup from then on, since probing entries
+// that keep missing would only add to it.
+//
+// Entries hold their shapes and methods strongly (the collector marks
+// them through the function), so an address can't be reused by a
+// different shape while a cache still mentions it
+struct PropertyCache {
+    static constexpr uint8_t MAX_ENTRIES = 4;
+
+    struct Entry {
+        ObjShape* shape;
+        ObjShape* next;    // SET_PROPERTY: the shape after the store, if it adds the field
+        Obj* method;       // GET_PROPERTY, INVOKE: the class's method, or nullptr for a field
+        uint32_t slot;     // the field's slot
+    };
+
+    Entry entries[MAX_ENTRIES];
+    uint8_t count = 0;
+    bool megamorphic = false;
+
+    const Entry* find(const ObjShape* shape) const {
+        for (uint8_t i = 0; i < count; i++) {
+            if (entries[i].shape == shape) return &entries[i];
+        }
+        return nullptr;
+    }
+
+    // Returns true if this was the miss that made the site megamorphic
+    bool add(const Entry& entry) {
+        if (megamorphic) return false;
+        if (count < MAX_ENTRIES) {
+            entries[count++] = entry;
+            return false;
+        }
+        count = 0;
+        megamorphic = true;
+        return true;
+    }
+};
+
+struct Chunk {
+    std::vector<uint8_t> code;
+    // Source line of every byte in `code`, for runtime error messages
+    std::vector<int> lines;
+    std::vector<Value> constants;
+    std::vector<PropertyCache> caches;
+
+    void write(uint8_t byte, int line) {
+        code.push_back(byte);
+        lines.push_back(line);
+    }
+
+    void write(OpCode op, int line) { write(static_cast<uint8_t>(op), line); }
+
+    size_t addConstant(Value value) {
+        constants.push_back(value);
+        return constants.size() - 1;
+    }
+
+    size_t addCache() {
+        caches.emplace_back();
+        return caches.size() - 1;
+    }
+};
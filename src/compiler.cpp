@@ -0,0 +1,906 @@
+#include "compiler.hpp"
+
+#include <charconv>
+#include <limits>
+
+#include "error.hpp"
+#include "natives.hpp"
+
+namespace {
+
+// Locals, upvalues and arguments are addressed by a one-byte operand
+constexpr size_t MAX_LOCALS = 256;
+
+}
+
+Compiler::Compiler(std::vector<Token> tokens) : tokens(std::move(tokens)) {
+    heap.addRoots(this);
+    for (const NativeDef& native : natives()) {
+        globalSlot(native.name);
+    }
+}
+
+Compiler::~Compiler() {
+    heap.removeRoots(this);
+}
+
+// Functions still being compiled are only reachable from here
+void Compiler::markRoots(Heap& heap) {
+    for (FunctionState* function = state; function != nullptr; function = function->enclosing) {
+        heap.markObject(function->function);
+    }
+    for (ObjString* name : globals) {
+        heap.markObject(name);
+    }
+    heap.markObject(script);
+}
+
+ObjFunction* Compiler::compile() {
+    FunctionState top{};
+    beginFunction(top, FunctionType::SCRIPT);
+    while (!isAtEnd()) {
+        declaration();
+    }
+    script = endFunction();
+    return had_error ? nullptr : script;
+}
+
+// Callers name the function afterwards, once it is reachable from `state`
+// and so safe from a collection the name's allocation might trigger
+void Compiler::beginFunction(FunctionState& function, FunctionType type) {
+    function.enclosing = state;
+    function.type = type;
+    function.function = heap.make<ObjFunction>();
+    function.locals.reserve(MAX_LOCALS);
+
+    // Slot 0 holds the function being called, or the receiver in methods
+    bool isMethod = type == FunctionType::METHOD || type == FunctionType::INITIALIZER;
+    function.locals.push_back({isMethod ? "this" : "", 0, false});
+    state = &function;
+}
+
+ObjFunction* Compiler::endFunction() {
+    emitReturn();
+    ObjFunction* function = state->function;
+    state = state->enclosing;
+    return function;
+}
+
+// Statements
+
+// A syntax error unwinds to the innermost declaration being compiled. The
+// function, class and scope it was in are put back the way they were
+// before skipping ahead to the next statement
+void Compiler::declaration() {
+    FunctionState* function = state;
+    ClassState* klass = currentClass;
+    int scopeDepth = state->scopeDepth;
+    size_t localCount = state->locals.size();
+
+    try {
+        if (match(TokenType::CLASS)) {
+            classDeclaration();
+        }
+        else if (match(TokenType::FUN)) {
+            funDeclaration();
+        }
+        else if (match(TokenType::VAR)) {
+            varDeclaration();
+        }
+        else {
+            statement();
+        }
+    }
+    catch (const ParseError&) {
+        state = function;
+        currentClass = klass;
+        state->scopeDepth = scopeDepth;
+        state->locals.resize(localCount);
+        synchronize();
+    }
+}
+
+void Compiler::classDeclaration() {
+    consume(TokenType::IDENTIFIER, "Expect class name.");
+    std::string_view className = previous().lexeme;
+    uint16_t nameConstant = identifierConstant(className);
+    declareVariable();
+
+    emitOpShort(OpCode::CLASS, nameConstant);
+    defineVariable(state->scopeDepth > 0 ? 0 : globalSlot(className));
+
+    ClassState classState{currentClass};
+    currentClass = &classState;
+
+    if (match(TokenType::LESS)) {
+        consume(TokenType::IDENTIFIER, "Expect superclass name.");
+        variable(false);
+        if (previous().lexeme == className) {
+            error(previous(), "A class can't inherit from itself.");
+        }
+
+        // `super` is a local in a scope wrapped around the methods, so they
+        // capture it like any other variable
+        beginScope();
+        addLocal("super");
+        defineVariable(0);
+
+        namedVariable(className, false);
+        emitOp(OpCode::INHERIT);
+        classState.hasSuperclass = true;
+    }
+
+    // The class stays on the stack while its methods are attached
+    namedVariable(className, false);
+    consume(TokenType::LEFT_BRACE, "Expect '{' before class body.");
+    while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        method();
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
+    emitOp(OpCode::POP);
+
+    if (classState.hasSuperclass) {
+        endScope();
+    }
+    currentClass = classState.enclosing;
+}
+
+void Compiler::method() {
+    consume(TokenType::IDENTIFIER, "Expect method name.");
+    uint16_t name = identifierConstant(previous().lexeme);
+    function(previous().lexeme == "init" ? FunctionType::INITIALIZER : FunctionType::METHOD);
+    emitOpShort(OpCode::METHOD, name);
+}
+
+void Compiler::funDeclaration() {
+    uint16_t global = parseVariable("Expect function name.");
+    // A function may refer to itself, so it is usable before its body ends
+    markInitialized();
+    function(FunctionType::FUNCTION);
+    defineVariable(global);
+}
+
+// Compiles a parameter list and body (the name has just been consumed)
+// into a new function, and emits the code that wraps it in a closure.
+//
+// A function that captures nothing needs no closure when nothing can tell
+// it apart from another run of its declaration: a method, which is only
+// ever reached bound to a receiver, or a declaration at the top level of
+// the script outside any loop, which runs once. Those are loaded as a
+// constant and called as they are, so declaring them allocates nothing.
+// Any other declaration makes a fresh closure each time it runs, so
+// `==` sees a new function like it does on the tree-walker
+void Compiler::function(FunctionType type) {
+    const std::string kind = type == FunctionType::FUNCTION ? "function" : "method";
+
+    FunctionState inner{};
+    beginFunction(inner, type);
+    inner.function->name = heap.copyString(previous().lexeme);
+    beginScope();
+
+    consume(TokenType::LEFT_PAREN, "Expect '(' after " + kind + " name.");
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            state->function->arity++;
+            if (state->function->arity > 255) {
+                error(peek(), "Can't have more than 255 parameters.");
+            }
+            uint16_t parameter = parseVariable("Expect parameter name.");
+            defineVariable(parameter);
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TokenType::LEFT_BRACE, "Expect '{' before " + kind + " body.");
+    block();
+
+    // No endScope(): returning discards the whole frame anyway
+    ObjFunction* function = endFunction();
+    bool runsOnce = state->type == FunctionType::SCRIPT && state->loopDepth == 0;
+    if (inner.upvalues.empty() && (type != FunctionType::FUNCTION || runsOnce)) {
+        emitConstant(Value::object(function));
+        return;
+    }
+    emitOpShort(OpCode::CLOSURE, makeConstant(Value::object(function)));
+    for (const Upvalue& upvalue : inner.upvalues) {
+        emitByte(upvalue.isLocal ? 1 : 0);
+        emitByte(upvalue.index);
+    }
+}
+
+void Compiler::varDeclaration() {
+    uint16_t global = parseVariable("Expect variable name.");
+
+    if (match(TokenType::EQUAL)) {
+        expression();
+    }
+    else {
+        emitOp(OpCode::NIL);
+    }
+    consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+
+    defineVariable(global);
+}
+
+void Compiler::statement() {
+    if (match(TokenType::PRINT)) {
+        printStatement();
+    }
+    else if (match(TokenType::FOR)) {
+        forStatement();
+    }
+    else if (match(TokenType::IF)) {
+        ifStatement();
+    }
+    else if (match(TokenType::RETURN)) {
+        returnStatement();
+    }
+    else if (match(TokenType::WHILE)) {
+        whileStatement();
+    }
+    else if (match(TokenType::LEFT_BRACE)) {
+        beginScope();
+        block();
+        endScope();
+    }
+    else {
+        expressionStatement();
+    }
+}
+
+void Compiler::printStatement() {
+    expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after value.");
+    emitOp(OpCode::PRINT);
+}
+
+void Compiler::expressionStatement() {
+    expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+    emitOp(OpCode::POP);
+}
+
+// JUMP_IF_FALSE leaves the condition on the stack, so each branch starts
+// by popping it
+void Compiler::ifStatement() {
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition.");
+
+    int thenJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emitOp(OpCode::POP);
+    statement();
+
+    int elseJump = emitJump(OpCode::JUMP);
+    patchJump(thenJump);
+    emitOp(OpCode::POP);
+
+    if (match(TokenType::ELSE)) {
+        statement();
+    }
+    patchJump(elseJump);
+}
+
+void Compiler::whileStatement() {
+    int loopStart = static_cast<int>(chunk().code.size());
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+
+    int exitJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emitOp(OpCode::POP);
+    state->loopDepth++;
+    statement();
+    state->loopDepth--;
+    emitLoop(loopStart);
+
+    patchJump(exitJump);
+    emitOp(OpCode::POP);
+}
+
+// The increment clause is compiled before the body but runs after it: the
+// body jumps back to the increment, which loops back to the condition
+void Compiler::forStatement() {
+    beginScope();
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+    if (match(TokenType::SEMICOLON)) {
+        // No initializer
+    }
+    else if (match(TokenType::VAR)) {
+        varDeclaration();
+    }
+    else {
+        expressionStatement();
+    }
+
+    int loopStart = static_cast<int>(chunk().code.size());
+    int exitJump = -1;
+    if (!match(TokenType::SEMICOLON)) {
+        expression();
+        consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
+        exitJump = emitJump(OpCode::JUMP_IF_FALSE);
+        emitOp(OpCode::POP);
+    }
+
+    if (!match(TokenType::RIGHT_PAREN)) {
+        int bodyJump = emitJump(OpCode::JUMP);
+        int incrementStart = static_cast<int>(chunk().code.size());
+        expression();
+        emitOp(OpCode::POP);
+        consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+
+        emitLoop(loopStart);
+        loopStart = incrementStart;
+        patchJump(bodyJump);
+    }
+
+    state->loopDepth++;
+    statement();
+    state->loopDepth--;
+    emitLoop(loopStart);
+
+    if (exitJump != -1) {
+        patchJump(exitJump);
+        emitOp(OpCode::POP);
+    }
+    endScope();
+}
+
+void Compiler::returnStatement() {
+    if (state->type == FunctionType::SCRIPT) {
+        error(previous(), "Can't return from top-level code.");
+    }
+
+    if (match(TokenType::SEMICOLON)) {
+        emitReturn();
+        return;
+    }
+
+    if (state->type == FunctionType::INITIALIZER) {
+        error(previous(), "Can't return a value from an initializer.");
+    }
+    expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+    emitOp(OpCode::RETURN);
+}
+
+// Expects the '{' to have been consumed already
+void Compiler::block() {
+    while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        declaration();
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+}
+
+void Compiler::synchronize() {
+    advance();
+    while (!isAtEnd()) {
+        if (previous().type == TokenType::SEMICOLON) return;
+
+        switch (peek().type) {
+            case TokenType::CLASS:
+            case TokenType::FUN:
+            case TokenType::VAR:
+            case TokenType::FOR:
+            case TokenType::IF:
+            case TokenType::WHILE:
+            case TokenType::PRINT:
+            case TokenType::RETURN:
+                return;
+            default:
+                break;
+        }
+        advance();
+    }
+}
+
+// The Pratt table, the same shape as the parser's
+
+const Compiler::ParseRule& Compiler::getRule(TokenType type) {
+    static const ParseRule none            {nullptr,                     nullptr,                Precedence::NONE};
+    static const ParseRule leftParen       {&Compiler::grouping,         &Compiler::call,        Precedence::CALL};
+    static const ParseRule dot             {nullptr,                     &Compiler::dot,         Precedence::CALL};
+    static const ParseRule minus           {&Compiler::unary,            &Compiler::binary,      Precedence::TERM};
+    static const ParseRule plus            {nullptr,                     &Compiler::binary,      Precedence::TERM};
+    static const ParseRule factor          {nullptr,                     &Compiler::binary,      Precedence::FACTOR};
+    static const ParseRule bang            {&Compiler::unary,            nullptr,                Precedence::NONE};
+    static const ParseRule equality        {nullptr,                     &Compiler::binary,      Precedence::EQUALITY};
+    static const ParseRule comparison      {nullptr,                     &Compiler::binary,      Precedence::COMPARISON};
+    static const ParseRule identifier      {&Compiler::variable,         nullptr,                Precedence::NONE};
+    static const ParseRule stringLiteral   {&Compiler::string,           nullptr,                Precedence::NONE};
+    static const ParseRule numberLiteral   {&Compiler::number,           nullptr,                Precedence::NONE};
+    static const ParseRule keywordLiteral  {&Compiler::literal,          nullptr,                Precedence::NONE};
+    static const ParseRule andRule         {nullptr,                     &Compiler::andOperator, Precedence::AND};
+    static const ParseRule orRule          {nullptr,                     &Compiler::orOperator,  Precedence::OR};
+    static const ParseRule thisRule        {&Compiler::thisExpression,   nullptr,                Precedence::NONE};
+    static const ParseRule superRule       {&Compiler::superExpression,  nullptr,                Precedence::NONE};
+
+    switch (type) {
+        case TokenType::LEFT_PAREN: return leftParen;
+        case TokenType::DOT: return dot;
+        case TokenType::MINUS: return minus;
+        case TokenType::PLUS: return plus;
+        case TokenType::SLASH:
+        case TokenType::STAR: return factor;
+        case TokenType::BANG: return bang;
+        case TokenType::BANG_EQUAL:
+        case TokenType::EQUAL_EQUAL: return equality;
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL: return comparison;
+        case TokenType::IDENTIFIER: return identifier;
+        case TokenType::STRING: return stringLiteral;
+        case TokenType::NUMBER: return numberLiteral;
+        case TokenType::TRUE:
+        case TokenType::FALSE:
+        case TokenType::NIL: return keywordLiteral;
+        case TokenType::AND: return andRule;
+        case TokenType::OR: return orRule;
+        case TokenType::THIS: return thisRule;
+        case TokenType::SUPER: return superRule;
+        default: return none;
+    }
+}
+
+// Expressions
+
+void Compiler::expression() {
+    parsePrecedence(Precedence::ASSIGNMENT);
+}
+
+void Compiler::parsePrecedence(Precedence precedence) {
+    ParseFn prefix = getRule(peek().type).prefix;
+    if (prefix == nullptr) {
+        throw error(peek(), "Expect expression.");
+    }
+    advance();
+
+    bool canAssign = precedence <= Precedence::ASSIGNMENT;
+    (this->*prefix)(canAssign);
+
+    while (precedence <= getRule(peek().type).precedence) {
+        advance();
+        (this->*getRule(previous().type).infix)(canAssign);
+    }
+
+    if (canAssign && match(TokenType::EQUAL)) {
+        throw error(previous(), "Invalid assignment target.");
+    }
+}
+
+void Compiler::number(bool) {
+    const std::string& lexeme = previous().lexeme;
+    double value = 0;
+    std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), value);
+    emitConstant(Value::number(value));
+}
+
+void Compiler::string(bool) {
+    emitConstant(Value::object(heap.copyString(previous().literal)));
+}
+
+void Compiler::literal(bool) {
+    switch (previous().type) {
+        case TokenType::TRUE: emitOp(OpCode::TRUE); break;
+        case TokenType::FALSE: emitOp(OpCode::FALSE); break;
+        default: emitOp(OpCode::NIL); break;
+    }
+}
+
+void Compiler::grouping(bool) {
+    expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+}
+
+void Compiler::unary(bool) {
+    TokenType op = previous().type;
+    parsePrecedence(Precedence::UNARY);
+    emitOp(op == TokenType::BANG ? OpCode::NOT : OpCode::NEGATE);
+}
+
+void Compiler::binary(bool) {
+    TokenType op = previous().type;
+    const ParseRule& rule = getRule(op);
+    parsePrecedence(static_cast<Precedence>(static_cast<uint8_t>(rule.precedence) + 1));
+
+    switch (op) {
+        case TokenType::BANG_EQUAL: emitOp(OpCode::NOT_EQUAL); break;
+        case TokenType::EQUAL_EQUAL: emitOp(OpCode::EQUAL); break;
+        case TokenType::GREATER: emitOp(OpCode::GREATER); break;
+        case TokenType::GREATER_EQUAL: emitOp(OpCode::GREATER_EQUAL); break;
+        case TokenType::LESS: emitOp(OpCode::LESS); break;
+        case TokenType::LESS_EQUAL: emitOp(OpCode::LESS_EQUAL); break;
+        case TokenType::PLUS: emitOp(OpCode::ADD); break;
+        case TokenType::MINUS: emitOp(OpCode::SUBTRACT); break;
+        case TokenType::STAR: emitOp(OpCode::MULTIPLY); break;
+        case TokenType::SLASH: emitOp(OpCode::DIVIDE); break;
+        default: break;
+    }
+}
+
+// `and` and `or` are control flow: the right operand is jumped over when
+// the left one already decides the result
+void Compiler::andOperator(bool) {
+    int endJump = emitJump(OpCode::JUMP_IF_FALSE);
+    emitOp(OpCode::POP);
+    parsePrecedence(Precedence::AND);
+    patchJump(endJump);
+}
+
+void Compiler::orOperator(bool) {
+    int elseJump = emitJump(OpCode::JUMP_IF_FALSE);
+    int endJump = emitJump(OpCode::JUMP);
+
+    patchJump(elseJump);
+    emitOp(OpCode::POP);
+
+    parsePrecedence(Precedence::OR);
+    patchJump(endJump);
+}
+
+void Compiler::variable(bool canAssign) {
+    namedVariable(previous().lexeme, canAssign);
+}
+
+void Compiler::call(bool) {
+    uint8_t argCount = argumentList();
+    emitOp(OpCode::CALL, argCount);
+}
+
+// A property access directly followed by a call compiles to INVOKE, which
+// skips creating the bound method
+void Compiler::dot(bool canAssign) {
+    consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+    uint16_t name = identifierConstant(previous().lexeme);
+
+    if (canAssign && match(TokenType::EQUAL)) {
+        expression();
+        emitOpShort(OpCode::SET_PROPERTY, name);
+        emitShort(makeCache());
+    }
+    else if (match(TokenType::LEFT_PAREN)) {
+        uint8_t argCount = argumentList();
+        emitOpShort(OpCode::INVOKE, name);
+        emitByte(argCount);
+        emitShort(makeCache());
+    }
+    else {
+        emitOpShort(OpCode::GET_PROPERTY, name);
+        emitShort(makeCache());
+    }
+}
+
+void Compiler::thisExpression(bool) {
+    if (currentClass == nullptr) {
+        error(previous(), "Can't use 'this' outside of a class.");
+        return;
+    }
+    variable(false);
+}
+
+void Compiler::superExpression(bool) {
+    if (currentClass == nullptr) {
+        error(previous(), "Can't use 'super' outside of a class.");
+    }
+    else if (!currentClass->hasSuperclass) {
+        error(previous(), "Can't use 'super' in a class with no superclass.");
+    }
+
+    consume(TokenType::DOT, "Expect '.' after 'super'.");
+    consume(TokenType::IDENTIFIER, "Expect superclass method name.");
+    uint16_t name = identifierConstant(previous().lexeme);
+
+    namedVariable("this", false);
+    if (match(TokenType::LEFT_PAREN)) {
+        uint8_t argCount = argumentList();
+        namedVariable("super", false);
+        emitOpShort(OpCode::SUPER_INVOKE, name);
+        emitByte(argCount);
+    }
+    else {
+        namedVariable("super", false);
+        emitOpShort(OpCode::GET_SUPER, name);
+    }
+}
+
+uint8_t Compiler::argumentList() {
+    int argCount = 0;
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            expression();
+            if (argCount == 255) {
+                error(previous(), "Can't have more than 255 arguments.");
+            }
+            argCount++;
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+    return static_cast<uint8_t>(argCount);
+}
+
+// Variables and scopes
+
+void Compiler::beginScope() {
+    state->scopeDepth++;
+}
+
+// Locals that a closure captured are moved to the heap on the way out
+void Compiler::endScope() {
+    state->scopeDepth--;
+    std::vector<Local>& locals = state->locals;
+    while (!locals.empty() && locals.back().depth > state->scopeDepth) {
+        emitOp(locals.back().isCaptured ? OpCode::CLOSE_UPVALUE : OpCode::POP);
+        locals.pop_back();
+    }
+}
+
+void Compiler::namedVariable(std::string_view name, bool canAssign) {
+    OpCode getOp;
+    OpCode setOp;
+    int arg = resolveLocal(*state, name);
+    if (arg != -1) {
+        getOp = OpCode::GET_LOCAL;
+        setOp = OpCode::SET_LOCAL;
+    }
+    else if ((arg = resolveUpvalue(*state, name)) != -1) {
+        getOp = OpCode::GET_UPVALUE;
+        setOp = OpCode::SET_UPVALUE;
+    }
+    else {
+        arg = globalSlot(name);
+        getOp = OpCode::GET_GLOBAL;
+        setOp = OpCode::SET_GLOBAL;
+    }
+
+    bool isGlobal = getOp == OpCode::GET_GLOBAL;
+    OpCode op = getOp;
+    if (canAssign && match(TokenType::EQUAL)) {
+        expression();
+        op = setOp;
+    }
+
+    if (isGlobal) {
+        emitOpShort(op, static_cast<uint16_t>(arg));
+    }
+    else {
+        emitOp(op, static_cast<uint8_t>(arg));
+    }
+}
+
+// Returns the global's index, or 0 for a local, which just takes the next
+// stack slot
+uint16_t Compiler::parseVariable(const std::string& message) {
+    consume(TokenType::IDENTIFIER, message);
+
+    declareVariable();
+    if (state->scopeDepth > 0) return 0;
+
+    return globalSlot(previous().lexeme);
+}
+
+void Compiler::declareVariable() {
+    if (state->scopeDepth == 0) return;
+
+    std::string_view name = previous().lexeme;
+    for (auto local = state->locals.rbegin(); local != state->locals.rend(); ++local) {
+        if (local->depth != -1 && local->depth < state->scopeDepth) break;
+        if (local->name == name) {
+            error(previous(), "Already a variable with this name in this scope.");
+        }
+    }
+    addLocal(name);
+}
+
+void Compiler::defineVariable(uint16_t global) {
+    if (state->scopeDepth > 0) {
+        markInitialized();
+        return;
+    }
+    emitOpShort(OpCode::DEFINE_GLOBAL, global);
+}
+
+void Compiler::addLocal(std::string_view name) {
+    if (state->locals.size() == MAX_LOCALS) {
+        error(previous(), "Too many local variables in function.");
+        return;
+    }
+    state->locals.push_back({name, -1, false});
+}
+
+void Compiler::markInitialized() {
+    if (state->scopeDepth == 0) return;
+    state->locals.back().depth = state->scopeDepth;
+}
+
+int Compiler::resolveLocal(FunctionState& function, std::string_view name) {
+    for (int i = static_cast<int>(function.locals.size()) - 1; i >= 0; i--) {
+        const Local& local = function.locals[i];
+        if (local.name == name) {
+            if (local.depth == -1) {
+                error(previous(), "Can't read local variable in its own initializer.");
+            }
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Looks the name up in each enclosing function in turn. Every function in
+// between gets an upvalue too, so the variable is handed down one level at
+// a time when the closures are created
+int Compiler::resolveUpvalue(FunctionState& function, std::string_view name) {
+    if (function.enclosing == nullptr) return -1;
+
+    int local = resolveLocal(*function.enclosing, name);
+    if (local != -1) {
+        function.enclosing->locals[local].isCaptured = true;
+        return addUpvalue(function, static_cast<uint8_t>(local), true);
+    }
+
+    int upvalue = resolveUpvalue(*function.enclosing, name);
+    if (upvalue != -1) {
+        return addUpvalue(function, static_cast<uint8_t>(upvalue), false);
+    }
+    return -1;
+}
+
+int Compiler::addUpvalue(FunctionState& function, uint8_t index, bool isLocal) {
+    for (size_t i = 0; i < function.upvalues.size(); i++) {
+        const Upvalue& upvalue = function.upvalues[i];
+        if (upvalue.index == index && upvalue.isLocal == isLocal) {
+            return static_cast<int>(i);
+        }
+    }
+
+    if (function.upvalues.size() == MAX_LOCALS) {
+        error(previous(), "Too many closure variables in function.");
+        return 0;
+    }
+
+    function.upvalues.push_back({index, isLocal});
+    function.function->upvalueCount = static_cast<int>(function.upvalues.size());
+    return static_cast<int>(function.upvalues.size() - 1);
+}
+
+// Emitting code
+
+// Code belongs to the line of the token just compiled. An empty script
+// has none, so its implicit return takes the line of the end of file
+void Compiler::emitByte(uint8_t byte) {
+    chunk().write(byte, current == 0 ? peek().line : previous().line);
+}
+
+void Compiler::emitOp(OpCode op) {
+    emitByte(static_cast<uint8_t>(op));
+}
+
+void Compiler::emitOp(OpCode op, uint8_t operand) {
+    emitOp(op);
+    emitByte(operand);
+}
+
+void Compiler::emitOpShort(OpCode op, uint16_t operand) {
+    emitOp(op);
+    emitShort(operand);
+}
+
+void Compiler::emitShort(uint16_t value) {
+    emitByte(static_cast<uint8_t>(value >> 8));
+    emitByte(static_cast<uint8_t>(value));
+}
+
+void Compiler::emitConstant(Value value) {
+    emitOpShort(OpCode::CONSTANT, makeConstant(value));
+}
+
+// An initializer always returns `this`, even from a bare `return;`
+void Compiler::emitReturn() {
+    if (state->type == FunctionType::INITIALIZER) {
+        emitOp(OpCode::GET_LOCAL, 0);
+    }
+    else {
+        emitOp(OpCode::NIL);
+    }
+    emitOp(OpCode::RETURN);
+}
+
+// Emits a jump with a placeholder offset and returns where the offset is,
+// for patchJump to fill in once the target is known
+int Compiler::emitJump(OpCode op) {
+    emitOp(op);
+    emitShort(0xffff);
+    return static_cast<int>(chunk().code.size() - 2);
+}
+
+void Compiler::patchJump(int offset) {
+    // -2 for the offset bytes themselves, which the VM has already read
+    size_t jump = chunk().code.size() - offset - 2;
+    if (jump > std::numeric_limits<uint16_t>::max()) {
+        error(previous(), "Too much code to jump over.");
+    }
+    chunk().code[offset] = static_cast<uint8_t>(jump >> 8);
+    chunk().code[offset + 1] = static_cast<uint8_t>(jump);
+}
+
+void Compiler::emitLoop(int loopStart) {
+    emitOp(OpCode::LOOP);
+    size_t offset = chunk().code.size() - loopStart + 2;
+    if (offset > std::numeric_limits<uint16_t>::max()) {
+        error(previous(), "Loop body too large.");
+    }
+    emitShort(static_cast<uint16_t>(offset));
+}
+
+uint16_t Compiler::makeConstant(Value value) {
+    auto existing = state->constantIndex.find(value.raw());
+    if (existing != state->constantIndex.end()) return existing->second;
+
+    size_t index = chunk().addConstant(value);
+    if (index > std::numeric_limits<uint16_t>::max()) {
+        error(previous(), "Too many constants in one chunk.");
+        return 0;
+    }
+    state->constantIndex.emplace(value.raw(), static_cast<uint16_t>(index));
+    return static_cast<uint16_t>(index);
+}
+
+uint16_t Compiler::makeCache() {
+    size_t index = chunk().addCache();
+    if (index > std::numeric_limits<uint16_t>::max()) {
+        error(previous(), "Too many property accesses in one chunk.");
+        return 0;
+    }
+    return static_cast<uint16_t>(index);
+}
+
+uint16_t Compiler::identifierConstant(std::string_view name) {
+    return makeConstant(Value::object(heap.copyString(name)));
+}
+
+// Globals are numbered as the compiler first sees them, so the VM keeps
+// them in a plain array. A name used but never defined still gets a slot;
+// reading it is a runtime error, as it would be with late binding
+uint16_t Compiler::globalSlot(std::string_view name) {
+    auto existing = globalIndex.find(name);
+    if (existing != globalIndex.end()) return existing->second;
+
+    if (globals.size() > std::numeric_limits<uint16_t>::max()) {
+        error(previous(), "Too many global variables.");
+        return 0;
+    }
+    ObjString* string = heap.copyString(name);
+    uint16_t index = static_cast<uint16_t>(globals.size());
+    globals.push_back(string);
+    globalIndex.emplace(string->view(), index);
+    return index;
+}
+
+// Token stream
+
+void Compiler::advance() {
+    if (!isAtEnd()) current++;
+}
+
+bool Compiler::match(TokenType type) {
+    if (!check(type)) return false;
+    advance();
+    return true;
+}
+
+void Compiler::consume(TokenType type, const std::string& message) {
+    if (check(type)) {
+        advance();
+        return;
+    }
+    throw error(peek(), message);
+}
+
+ParseError Compiler::error(const Token& token, const std::string& message) {
+    if (token.type == TokenType::END_OF_FILE) {
+        report(token.line, " at end", message);
+    }
+    else {
+        report(token.line, " at '" + token.lexeme + "'", message);
+    }
+    return ParseError();
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hpp"
+#include "object.hpp"
+#include "parser.hpp"
+#include "token.hpp"
+
+// Single-pass compiler from tokens straight to bytecode for the VM engine.
+// It is a Pratt parser like Parser, but each parselet emits code instead of
+// building nodes, so no tree is ever materialised. Syntax errors are
+// reported in the same format as the parser's
+class Compiler : public GcRoots {
+public:
+    explicit Compiler(std::vector<Token> tokens);
+    ~Compiler();
+
+    Compiler(const Compiler&) = delete;
+    Compiler& operator=(const Compiler&) = delete;
+
+    // Compiles the whole program into a top-level script function. Returns
+    // nullptr if there was a compile error (already reported)
+    ObjFunction* compile();
+
+    // Every global the program mentions, by the dense index its GET_GLOBAL,
+    // SET_GLOBAL and DEFINE_GLOBAL instructions carry. Natives come first,
+    // in natives() order
+    const std::vector<ObjString*>& globalNames() const { return globals; }
+
+    // Line of the token being compiled, for the heap profiler
+    int currentLine() const { return peek().line; }
+
+private:
+    enum class FunctionType : uint8_t { SCRIPT, FUNCTION, METHOD, INITIALIZER };
+
+    using ParseFn = void (Compiler::*)(bool canAssign);
+
+    struct ParseRule {
+        ParseFn prefix;
+        ParseFn infix;
+        Precedence precedence;
+    };
+
+    struct Local {
+        std::string_view name;
+        int depth;          // -1 while the initializer is still running
+        bool isCaptured;
+    };
+
+    struct Upvalue {
+        uint8_t index;
+        bool isLocal;       // captures an enclosing local rather than one of its upvalues
+    };
+
+    // Per-function compilation state. These nest with the source, innermost
+    // first, and live on the C++ stack for as long as the function's body
+    // is being compiled
+    struct FunctionState {
+        FunctionState* enclosing;
+        ObjFunction* function;
+        FunctionType type;
+        std::vector<Local> locals;
+        std::vector<Upvalue> upvalues;
+        int scopeDepth = 0;
+        int loopDepth = 0;      // loop bodies the code being compiled is in
+        // Constant index of every number and string already in the chunk,
+        // keyed by the Value's bits, so repeated literals share a slot
+        std::unordered_map<uint64_t, uint16_t> constantIndex;
+    };
+
+    struct ClassState {
+        ClassState* enclosing;
+        bool hasSuperclass = false;
+    };
+
+    std::vector<Token> tokens;
+    uint32_t current = 0;
+    FunctionState* state = nullptr;
+    ClassState* currentClass = nullptr;
+    std::vector<ObjString*> globals;
+    std::unordered_map<std::string_view, uint16_t> globalIndex;
+    // The finished script, kept alive until the VM has it on its stack
+    ObjFunction* script = nullptr;
+
+    void markRoots(Heap& heap) override;
+
+    static const ParseRule& getRule(TokenType type);
+
+    void beginFunction(FunctionState& function, FunctionType type);
+    ObjFunction* endFunction();
+    Chunk& chunk() { return state->function->chunk; }
+
+    // Statements
+    void declaration();
+    void classDeclaration();
+    void method();
+    void funDeclaration();
+    void function(FunctionType type);
+    void varDeclaration();
+    void statement();
+    void printStatement();
+    void expressionStatement();
+    void ifStatement();
+    void whileStatement();
+    void forStatement();
+    void returnStatement();
+    void block();
+    void synchronize();
+
+    // Expressions
+    void expression();
+    void parsePrecedence(Precedence precedence);
+    void number(bool canAssign);
+    void string(bool canAssign);
+    void literal(bool canAssign);
+    void grouping(bool canAssign);
+    void unary(bool canAssign);
+    void binary(bool canAssign);
+    void andOperator(bool canAssign);
+    void orOperator(bool canAssign);
+    void variable(bool canAssign);
+    void call(bool canAssign);
+    void dot(bool canAssign);
+    void thisExpression(bool canAssign);
+    void superExpression(bool canAssign);
+    uint8_t argumentList();
+
+    // Variables and scopes
+    void beginScope();
+    void endScope();
+    void namedVariable(std::string_view name, bool canAssign);
+    uint16_t parseVariable(const std::string& message);
+    void declareVariable();
+    void defineVariable(uint16_t global);
+    void addLocal(std::string_view name);
+    void markInitialized();
+    int resolveLocal(FunctionState& function, std::string_view name);
+    int resolveUpvalue(FunctionState& function, std::string_view name);
+    int addUpvalue(FunctionState& function, uint8_t index, bool isLocal);
+
+    // Emitting code
+    void emitByte(uint8_t byte);
+    void emitOp(OpCode op);
+    void emitOp(OpCode op, uint8_t operand);
+    void emitOpShort(OpCode op, uint16_t operand);
+    void emitConstant(Value value);
+    void emitShort(uint16_t value);
+    void emitReturn();
+    int emitJump(OpCode op);
+    void patchJump(int offset);
+    void emitLoop(int loopStart);
+    uint16_t makeConstant(Value value);
+    uint16_t makeCache();
+    uint16_t identifierConstant(std::string_view name);
+    uint16_t globalSlot(std::string_view name);
+
+    // Token stream
+    const Token& peek() const { return tokens[current]; }
+    const Token& previous() const { return tokens[current - 1]; }
+    bool isAtEnd() const { return peek().type == TokenType::END_OF_FILE; }
+    bool check(TokenType type) const { return peek().type == type; }
+    void advance();
+    bool match(TokenType type);
+    void consume(TokenType type, const std::string& message);
+
+    ParseError error(const Token& token, const std::string& message);
+};
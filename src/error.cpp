@@ -0,0 +1,34 @@
+#include "error.hpp"
+#include "trace.hpp"
+
+#ifdef LOX_LEAN_IO
+#include "lean_io.hpp"
+#else
+#include <iostream>
+#endif
+
+bool had_error = false;
+
+void error(int line, const std::string& message) {
+    LOX_TRACE_ERROR(line);
+    report(line, "", message);
+}
+
+void report(int line, const std::string& where, const std::string& message) {
+#ifdef LOX_LEAN_IO
+    FdWriter err(STDERR_FILENO);
+    err << "[line " << std::to_string(line) << "] Error" << where << ": " << message << '\n';
+#else
+    std::cerr << "[line " << line << "] Error" << where << ": " << message << '\n';
+#endif
+    had_error = true;
+}
+
+void runtime_error(int line, const std::string& message) {
+#ifdef LOX_LEAN_IO
+    FdWriter err(STDERR_FILENO);
+    err << message << "\n[line " << std::to_string(line) << "]\n";
+#else
+    std::cerr << message << "\n[line " << line << "]\n";
+#endif
+}
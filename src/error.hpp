@@ -0,0 +1,11 @@
+#pragma once
+
+#include <string>
+
+extern bool had_error;
+void error(int line, const std::string& message);
+void report(int line, const std::string& where, const std::string& message);
+
+// Runtime errors have their own format: the message, then the line it
+// happened on. Whoever reports one also stops the run and makes it exit 70
+void runtime_error(int line, const std::string& message);
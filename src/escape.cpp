@@ -0,0 +1,257 @@
+#include "escape.hpp"
+
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+
+// Instances that could need more fields than this stay on the heap
+constexpr uint32_t MAX_FRAME_FIELDS = 32;
+
+using Names = std::unordered_set<std::string_view>;
+
+struct ClassInfo {
+    NodeIndex declaration;
+    enum class State : uint8_t { UNCHECKED, CHECKING, SAFE, UNSAFE } state = State::UNCHECKED;
+    Names methods;  // including inherited ones
+    Names fields;   // every field a method stores on `this`
+};
+
+// What is being tracked: `this` inside a method body, or the local in `slot`
+// of the block being analysed
+struct Subject {
+    bool isThis;
+    uint32_t slot;
+};
+
+class EscapeAnalysis {
+public:
+    explicit EscapeAnalysis(Ast& ast) : ast(ast) {}
+
+    size_t run();
+
+private:
+    Ast& ast;
+    // Classes a construction site can be traced back to, by name
+    std::unordered_map<std::string_view, ClassInfo> classes;
+    size_t sites = 0;
+    // The call of the expression statement being checked, whose result is
+    // thrown away
+    NodeIndex discardedCall = NO_NODE;
+
+    void findClasses();
+    const ClassInfo* checkedClass(std::string_view name);
+    void visit(NodeIndex index);
+    void block(const Node& node);
+    bool contained(NodeIndex index, const Subject& subject, uint32_t depth, const Names& methods, Names& fields);
+    bool declaresCode(NodeIndex index) const;
+
+    bool is(NodeIndex index, const Subject& subject, uint32_t depth) const {
+        const Node& node = ast[index];
+        if (subject.isThis) return node.kind == NodeKind::THIS;
+        const Binding& binding = ast.bindings[index];
+        return node.kind == NodeKind::VARIABLE && binding.depth == depth && binding.slot == subject.slot;
+    }
+
+    std::string_view name(const Node& node) const { return ast.token(node).lexeme; }
+};
+
+size_t EscapeAnalysis::run() {
+    ast.frameFields.assign(ast.nodes.size(), NOT_IN_FRAME);
+    if (ast.root == NO_NODE || ast[ast.root].kind != NodeKind::PROGRAM) return 0;
+    findClasses();
+    visit(ast.root);
+    return sites;
+}
+
+// A global class declared once, whose name nothing else declares or
+// assigns, is the only thing a call through that name can construct.
+// Every node counts here, even ones folding made unreachable, which can
+// only rule classes out
+void EscapeAnalysis::findClasses() {
+    std::unordered_map<std::string_view, uint32_t> declarations;
+    Names ruledOut;
+    for (NodeIndex index = 0; index < ast.nodes.size(); index++) {
+        const Node& node = ast.nodes[index];
+        bool global = ast.bindings[index].depth == GLOBAL;
+        switch (node.kind) {
+            case NodeKind::CLASS:
+                if (declarations[name(node)]++ == 0) classes[name(node)] = {index, ClassInfo::State::UNCHECKED, {}, {}};
+                if (!global) ruledOut.insert(name(node));
+                break;
+            case NodeKind::VAR:
+            case NodeKind::FUNCTION:
+            case NodeKind::ASSIGN:
+                if (global) ruledOut.insert(name(node));
+                break;
+            default:
+                break;
+        }
+    }
+    std::erase_if(classes, [&](const auto& entry) {
+        return declarations[entry.first] != 1 || ruledOut.contains(entry.first);
+    });
+}
+
+// Returns the class if no method in its chain lets `this` escape
+const ClassInfo* EscapeAnalysis::checkedClass(std::string_view className) {
+    auto found = classes.find(className);
+    if (found == classes.end()) return nullptr;
+    ClassInfo& info = found->second;
+    if (info.state != ClassInfo::State::UNCHECKED) {
+        return info.state == ClassInfo::State::SAFE ? &info : nullptr;
+    }
+
+    // A cycle of superclasses fails at runtime anyway
+    info.state = ClassInfo::State::CHECKING;
+    const Node& node = ast[info.declaration];
+    if (node.a != NO_NODE) {
+        const ClassInfo* superclass = ast.bindings[node.a].depth == GLOBAL ? checkedClass(name(ast[node.a])) : nullptr;
+        if (superclass == nullptr) {
+            info.state = ClassInfo::State::UNSAFE;
+            return nullptr;
+        }
+        info.methods = superclass->methods;
+        info.fields = superclass->fields;
+    }
+
+    auto methods = ast.list(node.b, node.c);
+    for (NodeIndex method : methods) {
+        info.methods.insert(name(ast[method]));
+    }
+    Subject self{true, 0};
+    for (NodeIndex method : methods) {
+        NodeIndex body = ast[method].c;
+        if (declaresCode(body) || !contained(body, self, 0, info.methods, info.fields)) {
+            info.state = ClassInfo::State::UNSAFE;
+            return nullptr;
+        }
+    }
+    info.state = ClassInfo::State::SAFE;
+    return &info;
+}
+
+void EscapeAnalysis::visit(NodeIndex index) {
+    const Node& node = ast[index];
+    if (node.kind == NodeKind::BLOCK) block(node);
+    for_each_child(ast, node, [&](NodeIndex child) { visit(child); });
+}
+
+// Function bodies are BLOCKs too. A block that declares a function or class
+// anywhere inside could have its scope captured, and a captured scope would
+// still point at the instance after the block had exited
+void EscapeAnalysis::block(const Node& node) {
+    auto statements = ast.list(node.a, node.b);
+    bool checkedCode = false;
+    for (size_t i = 0; i < statements.size(); i++) {
+        const Node& declaration = ast[statements[i]];
+        if (declaration.kind != NodeKind::VAR || declaration.a == NO_NODE) continue;
+        const Node& call = ast[declaration.a];
+        if (call.kind != NodeKind::CALL) continue;
+        const Node& callee = ast[call.a];
+        if (callee.kind != NodeKind::VARIABLE || ast.bindings[call.a].depth != GLOBAL) continue;
+        const ClassInfo* info = checkedClass(name(callee));
+        if (info == nullptr) continue;
+
+        if (!checkedCode) {
+            for (NodeIndex statement : statements) {
+                if (declaresCode(statement)) return;
+            }
+            checkedCode = true;
+        }
+
+        Subject local{false, ast.bindings[statements[i]].slot};
+        Names fields = info->fields;
+        bool stays = true;
+        for (size_t j = i + 1; j < statements.size() && stays; j++) {
+            stays = contained(statements[j], local, 0, info->methods, fields);
+        }
+        if (stays && fields.size() <= MAX_FRAME_FIELDS) {
+            ast.frameFields[declaration.a] = static_cast<uint32_t>(fields.size());
+            sites++;
+        }
+    }
+}
+
+// Returns false if `index` lets the subject escape: anything but reading a
+// field, storing one or calling a method through it, except using the
+// result of a call to `init`, which is the subject. Reading a method
+// without calling it would bind it. Fields stored on the subject are added
+// to `fields`. `depth` counts the blocks entered since the subject's
+// declaration, so a shadowing local of the same slot isn't mistaken for it
+bool EscapeAnalysis::contained(NodeIndex index, const Subject& subject, uint32_t depth, const Names& methods,
+                               Names& fields) {
+    const Node& node = ast[index];
+    auto child = [&](NodeIndex next) { return contained(next, subject, depth, methods, fields); };
+
+    switch (node.kind) {
+        case NodeKind::VARIABLE:
+        case NodeKind::THIS:
+            return !is(index, subject, depth);
+
+        case NodeKind::SUPER:
+            return !subject.isThis;
+
+        case NodeKind::GET:
+            if (is(node.a, subject, depth)) return !methods.contains(name(node));
+            return child(node.a);
+
+        case NodeKind::SET:
+            if (is(node.a, subject, depth)) {
+                fields.insert(name(node));
+                return child(node.b);
+            }
+            return child(node.a) && child(node.b);
+
+        case NodeKind::CALL: {
+            const Node& callee = ast[node.a];
+            bool invoke = (callee.kind == NodeKind::GET && is(callee.a, subject, depth)) ||
+                          (callee.kind == NodeKind::SUPER && subject.isThis);
+            // Calling an initializer again hands back the subject itself,
+            // which is only harmless if nothing keeps it (`super.init(x);`)
+            if (invoke && name(callee) == "init" && index != discardedCall) return false;
+            if (!invoke && !child(node.a)) return false;
+            for (NodeIndex argument : ast.list(node.b, node.c)) {
+                if (!child(argument)) return false;
+            }
+            return true;
+        }
+
+        case NodeKind::EXPRESSION:
+            discardedCall = node.a;
+            return child(node.a);
+
+        case NodeKind::BLOCK:
+            for (NodeIndex statement : ast.list(node.a, node.b)) {
+                if (!contained(statement, subject, depth + 1, methods, fields)) return false;
+            }
+            return true;
+
+        case NodeKind::FUNCTION:
+        case NodeKind::CLASS:
+            return false;
+
+        default: {
+            // Assigning a new value to the local itself is fine; the value
+            // is checked like any other expression
+            bool stays = true;
+            for_each_child(ast, node, [&](NodeIndex next) { stays = stays && child(next); });
+            return stays;
+        }
+    }
+}
+
+bool EscapeAnalysis::declaresCode(NodeIndex index) const {
+    const Node& node = ast[index];
+    if (node.kind == NodeKind::FUNCTION || node.kind == NodeKind::CLASS) return true;
+    bool found = false;
+    for_each_child(ast, node, [&](NodeIndex child) { found = found || declaresCode(child); });
+    return found;
+}
+
+}
+
+size_t find_frame_allocations(Ast& ast) {
+    return EscapeAnalysis(ast).run();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast.hpp"
+
+// Escape analysis for the tree-walker, run after resolve() (and folding).
+// It looks for local declarations of the form `var p = C(...);` whose
+// instance can never be reached once the block declaring `p` has exited,
+// and records in ast.frameFields how many field slots such an instance
+// needs. The interpreter builds those instances in memory that belongs to
+// the block instead of on the heap, so the collector never allocates or
+// sweeps them.
+//
+// An instance stays in its block if `p` is only ever used to read a field
+// (`p.x`), store one (`p.x = v`) or call a method (`p.m()`), as long as
+// the result of calling `init`, the instance itself, is thrown away, and
+// every method of C, inherited ones included, only uses `this` the same
+// way, so it is never returned, passed, stored, captured or bound. To know which
+// class a call constructs without running the program, C has to be the only
+// class of its name and a global nothing else declares or assigns. To keep
+// the block's scope from outliving it, neither the block nor C's methods
+// may declare functions or classes.
+//
+// Returns how many construction sites were moved off the heap
+size_t find_frame_allocations(Ast& ast);
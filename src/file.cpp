@@ -0,0 +1,36 @@
+#include "file.hpp"
+
+#include <cstdlib>
+
+#ifdef LOX_LEAN_IO
+#include "lean_io.hpp"
+#else
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#endif
+
+std::string read_file_contents(const std::string& filename) {
+#ifdef LOX_LEAN_IO
+    std::string contents;
+    if (!read_file_raw(filename.c_str(), contents)) {
+        FdWriter err(STDERR_FILENO);
+        err << "Error reading file: " << filename << '\n';
+        err.flush();
+        std::exit(1);
+    }
+    return contents;
+#else
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error reading file: " << filename << std::endl;
+        std::exit(1);
+    }   
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    file.close();
+
+    return buffer.str();
+#endif
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+// Reads the whole file into memory. Prints an error and exits with status 1
+// if the file can't be opened
+std::string read_file_contents(const std::string& filename);
@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+
+#include "heap_profile.hpp"
+#include "object.hpp"
+#include "stats.hpp"
+
+Heap heap;
+
+namespace {
+
+// Cell sizes, 16 bytes apart for the small objects most programs are made
+// of and then in steps of a quarter of the next power of two, so no cell
+// wastes more than about a fifth of itself
+constexpr auto SIZE_CLASSES = [] {
+    std::array<uint32_t, 24> sizes{};
+    size_t count = 0;
+    for (uint32_t size = 16; size <= 128; size += 16) sizes[count++] = size;
+    for (uint32_t step = 32; step <= 256; step *= 2) {
+        for (uint32_t i = 5; i <= 8; i++) sizes[count++] = step * i;
+    }
+    return sizes;
+}();
+
+// Size class for every request size, rounded up to 16 bytes
+constexpr auto CLASS_FOR_SIZE = [] {
+    std::array<uint8_t, 2048 / 16 + 1> classes{};
+    uint8_t sizeClass = 0;
+    for (uint32_t units = 0; units < classes.size(); units++) {
+        while (SIZE_CLASSES[sizeClass] < units * 16) sizeClass++;
+        classes[units] = sizeClass;
+    }
+    return classes;
+}();
+
+static_assert(SIZE_CLASSES.back() == 2048);
+
+#ifdef LOX_STATS
+uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+#endif
+
+}
+
+// Header at the start of every page. The cells follow it, and a cell's
+// index in the page is its bit in both bitmaps
+struct Heap::Page {
+    static constexpr size_t MAX_CELLS = PAGE_SIZE / 16;
+    static constexpr size_t BITMAP_WORDS = MAX_CELLS / 64;
+
+    Page* next = nullptr;
+    uint32_t cellSize;
+    uint32_t cellCount;
+    uint64_t marks[BITMAP_WORDS] = {};
+    uint64_t used[BITMAP_WORDS] = {};
+
+    explicit Page(uint32_t cellSize) : cellSize(cellSize), cellCount((PAGE_SIZE - cellsOffset()) / cellSize) {}
+
+    static constexpr size_t cellsOffset() { return (sizeof(Page) + 15) & ~size_t{15}; }
+    char* cells() { return reinterpret_cast<char*>(this) + cellsOffset(); }
+    size_t indexOf(const void* cell) { return (static_cast<const char*>(cell) - cells()) / cellSize; }
+};
+
+struct alignas(16) Heap::LargeObject {
+    LargeObject* next;
+    size_t size;
+    bool marked = false;
+
+    Obj* object() { return reinterpret_cast<Obj*>(this + 1); }
+};
+
+Heap::Heap() {
+    for (uint32_t cellSize : SIZE_CLASSES) {
+        classes.push_back({cellSize});
+    }
+}
+
+Heap::~Heap() {
+    for (SizeClass& sizeClass : classes) {
+        for (Page* list : {sizeClass.pages, sizeClass.unswept}) {
+            while (list != nullptr) {
+                Page* next = list->next;
+                for (size_t i = 0; i < list->cellCount; i++) {
+                    if (list->used[i / 64] & (uint64_t{1} << (i % 64))) {
+                        destroy(reinterpret_cast<Obj*>(list->cells() + i * list->cellSize));
+                    }
+                }
+                std::free(list);
+                list = next;
+            }
+        }
+    }
+    while (largeObjects != nullptr) {
+        LargeObject* next = largeObjects->next;
+        destroy(largeObjects->object());
+        ::operator delete(largeObjects);
+        largeObjects = next;
+    }
+}
+
+// Allocation
+
+void* Heap::allocate(size_t size) {
+#ifdef LOX_STRESS_GC
+    collect();
+#else
+    if (bytesAllocated > nextGC) collect();
+#endif
+    void* memory = size > MAX_SMALL_SIZE ? allocateLarge(size)
+                                         : allocateSmall(classes[CLASS_FOR_SIZE[(size + 15) / 16]]);
+    LOX_STATS_ADD(gc_objects_allocated, 1);
+    LOX_STATS_ADD(gc_bytes_allocated, size);
+    if (profiler != nullptr) profiler->allocated(static_cast<Obj*>(memory), size);
+    return memory;
+}
+
+void* Heap::allocateSmall(SizeClass& sizeClass) {
+    while (sizeClass.freeList == nullptr) {
+        Page* page = sizeClass.unswept;
+        if (page == nullptr) {
+            addPage(sizeClass);
+            continue;
+        }
+        sizeClass.unswept = page->next;
+        page->next = sizeClass.pages;
+        sizeClass.pages = page;
+
+#ifdef LOX_STATS
+        uint64_t started = run_stats.enabled ? now_ns() : 0;
+        sweepPage(sizeClass, page);
+        if (run_stats.enabled) run_stats.gc_sweep_ns += now_ns() - started;
+#else
+        sweepPage(sizeClass, page);
+#endif
+    }
+
+    FreeCell* cell = sizeClass.freeList;
+    sizeClass.freeList = cell->next;
+    Page* page = pageOf(reinterpret_cast<Obj*>(cell));
+    size_t index = page->indexOf(cell);
+    page->used[index / 64] |= uint64_t{1} << (index % 64);
+    bytesAllocated += sizeClass.cellSize;
+    return cell;
+}
+
+// Objects too big for a size class carry their mark bit in a header in
+// front of them instead
+void* Heap::allocateLarge(size_t size) {
+    void* memory = ::operator new(sizeof(LargeObject) + size);
+    auto* header = new (memory) LargeObject{largeObjects, size};
+    largeObjects = header;
+    bytesAllocated += size;
+    return header->object();
+}
+
+void Heap::addPage(SizeClass& sizeClass) {
+    void* memory = std::aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+    if (memory == nullptr) throw std::bad_alloc();
+    auto* page = new (memory) Page(sizeClass.cellSize);
+    page->next = sizeClass.pages;
+    sizeClass.pages = page;
+
+    // Pushed from the end so cells are handed out in address order
+    for (size_t i = page->cellCount; i-- > 0;) {
+        auto* cell = reinterpret_cast<FreeCell*>(page->cells() + i * page->cellSize);
+        cell->next = sizeClass.freeList;
+        sizeClass.freeList = cell;
+    }
+}
+
+Heap::Page* Heap::pageOf(const Obj* object) {
+    return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(object) & ~(PAGE_SIZE - 1));
+}
+
+Heap::LargeObject* Heap::largeHeader(const Obj* object) {
+    return reinterpret_cast<LargeObject*>(const_cast<Obj*>(object)) - 1;
+}
+
+// Strings, closures, environments and instances carry variable-length data after the
+// header, so they are sized and constructed by hand
+
+ObjString* Heap::allocateString(std::string_view chars, uint32_t hash) {
+    size_t size = sizeof(ObjString) + chars.size() + 1;
+    auto* string = new (allocate(size)) ObjString(static_cast<uint32_t>(chars.size()), hash);
+    string->large = size > MAX_SMALL_SIZE;
+    std::memcpy(string->chars(), chars.data(), chars.size());
+    string->chars()[chars.size()] = '\0';
+    strings.set(string, Value::nil());
+    return string;
+}
+
+ObjString* Heap::copyString(std::string_view chars) {
+    uint32_t hash = hash_string(chars);
+    ObjString* interned = strings.findString(chars, hash);
+    if (interned != nullptr) return interned;
+    return allocateString(chars, hash);
+}
+
+Obj* Heap::concatenate(Obj* a, Obj* b) {
+    uint32_t length = string_length(a) + string_length(b);
+    if (length >= MIN_ROPE_LENGTH) return make<ObjRope>(length, a, b);
+
+    std::string joined;
+    joined.reserve(length);
+    joined.append(string_chars(a));
+    joined.append(string_chars(b));
+    return copyString(joined);
+}
+
+ObjClosure* Heap::makeClosure(ObjFunction* function) {
+    size_t upvalueCount = static_cast<size_t>(function->upvalueCount);
+    size_t size = sizeof(ObjClosure) + upvalueCount * sizeof(ObjUpvalue*);
+    auto* closure = new (allocate(size)) ObjClosure(function);
+    closure->large = size > MAX_SMALL_SIZE;
+    std::fill_n(closure->upvalues(), upvalueCount, nullptr);
+    return closure;
+}
+
+ObjEnvironment* Heap::makeEnvironment(ObjEnvironment* enclosing, uint32_t slotCount) {
+    size_t size = sizeof(ObjEnvironment) + slotCount * sizeof(Value);
+    auto* environment = new (allocate(size)) ObjEnvironment(enclosing, slotCount);
+    environment->large = size > MAX_SMALL_SIZE;
+    std::uninitialized_fill_n(environment->slots(), slotCount, Value::nil());
+    return environment;
+}
+
+// The first instance of a class has nothing to go by and gets a guess;
+// the ones after it get as many inline slots as the most fields any
+// instance of the class has had
+ObjInstance* Heap::makeInstance(ObjClass* klass) {
+    uint32_t inlineCapacity = FIRST_INSTANCE_SLOTS;
+    if (klass->rootShape == nullptr) {
+        klass->rootShape = make<ObjShape>(0);
+    }
+    else {
+        inlineCapacity = std::min(klass->instanceSlots, MAX_INLINE_SLOTS);
+    }
+
+    size_t size = instanceSize(inlineCapacity);
+    auto* instance = new (allocate(size)) ObjInstance(klass, klass->rootShape, inlineCapacity);
+    instance->large = size > MAX_SMALL_SIZE;
+    std::uninitialized_fill_n(instance->inlineSlots(), inlineCapacity, Value::nil());
+    return instance;
+}
+
+ObjInstance* Heap::makeInstanceIn(void* memory, ObjClass* klass, uint32_t fields) {
+    if (klass->rootShape == nullptr) klass->rootShape = make<ObjShape>(0);
+
+    auto* instance = new (memory) ObjInstance(klass, klass->rootShape, fields);
+    instance->inFrame = true;
+    std::uninitialized_fill_n(instance->inlineSlots(), fields, Value::nil());
+    return instance;
+}
+
+void Heap::setField(ObjInstance* instance, ObjString* name, Value value) {
+    if (Value* field = instance->field(name)) {
+        *field = value;
+        return;
+    }
+
+    ObjShape* shape = instance->shape;
+    ObjShape* next;
+    if (Value* transition = shape->transitions.find(name)) {
+        next = static_cast<ObjShape*>(transition->asObject());
+    }
+    else {
+        // The instance (and through it the shape) is rooted by the caller;
+        // the new shape is reachable from the old one before anything else
+        // can allocate
+        next = make<ObjShape>(shape->slotCount + 1);
+        shape->transitions.set(name, Value::object(next));
+        next->slots.addAll(shape->slots);
+        next->slots.set(name, Value::number(shape->slotCount));
+    }
+
+    uint32_t index = shape->slotCount;
+    if (index >= instance->inlineCapacity) {
+        uint32_t used = index - instance->inlineCapacity;
+        if (used == 0 || (used >= 4 && std::has_single_bit(used))) {
+            auto grown = std::make_unique<Value[]>(std::max(used * 2, 4u));
+            std::copy_n(instance->overflow.get(), used, grown.get());
+            instance->overflow = std::move(grown);
+        }
+    }
+    instance->shape = next;
+    instance->slot(index) = value;
+    ObjClass* klass = instance->klass;
+    klass->instanceSlots = std::max(klass->instanceSlots, next->slotCount);
+}
+
+// Everything else is trivially destructible
+void Heap::destroy(Obj* object) {
+    switch (object->type) {
+        case ObjType::CLASS: std::destroy_at(static_cast<ObjClass*>(object)); break;
+        case ObjType::INSTANCE: std::destroy_at(static_cast<ObjInstance*>(object)); break;
+        case ObjType::SHAPE: std::destroy_at(static_cast<ObjShape*>(object)); break;
+        case ObjType::ROPE: std::destroy_at(static_cast<ObjRope*>(object)); break;
+        case ObjType::FUNCTION: std::destroy_at(static_cast<ObjFunction*>(object)); break;
+        default: break;
+    }
+}
+
+// Marking
+
+void Heap::addRoots(GcRoots* source) {
+    roots.push_back(source);
+}
+
+void Heap::removeRoots(GcRoots* source) {
+    std::erase(roots, source);
+}
+
+void Heap::markObject(Obj* object) {
+    if (object == nullptr) return;
+
+    // An instance built in a frame has no bit in the page bitmaps, so it
+    // carries its own. Nothing frees it, but it still has to be traced once
+    // per collection even if it is reachable from itself
+    if (object->inFrame) {
+        if (object->frameMarked) return;
+        object->frameMarked = true;
+        markedFrameObjects.push_back(object);
+        grayStack.push_back(object);
+        return;
+    }
+
+    if (object->large) {
+        LargeObject* header = largeHeader(object);
+        if (header->marked) return;
+        header->marked = true;
+        markedBytes += header->size;
+    }
+    else {
+        Page* page = pageOf(object);
+        size_t index = page->indexOf(object);
+        uint64_t bit = uint64_t{1} << (index % 64);
+        if (page->marks[index / 64] & bit) return;
+        page->marks[index / 64] |= bit;
+        markedBytes += page->cellSize;
+    }
+
+    // Strings refer to nothing, so there's no point queueing them
+    if (object->type != ObjType::STRING) grayStack.push_back(object);
+}
+
+bool Heap::isMarked(Obj* object) const {
+    if (object->large) return largeHeader(object)->marked;
+    Page* page = pageOf(object);
+    size_t index = page->indexOf(object);
+    return page->marks[index / 64] & (uint64_t{1} << (index % 64));
+}
+
+void Heap::blacken(Obj* object) {
+    switch (object->type) {
+        case ObjType::STRING: break;
+        case ObjType::ROPE: {
+            auto* rope = static_cast<ObjRope*>(object);
+            markObject(rope->left);
+            markObject(rope->right);
+            break;
+        }
+        case ObjType::NATIVE: markObject(static_cast<ObjNative*>(object)->name); break;
+        case ObjType::AST_FUNCTION: {
+            auto* function = static_cast<ObjAstFunction*>(object);
+            markObject(function->closure);
+            markObject(function->name);
+            break;
+        }
+        case ObjType::CLASS: {
+            auto* klass = static_cast<ObjClass*>(object);
+            markObject(klass->name);
+            markObject(klass->superclass);
+            markObject(klass->rootShape);
+            klass->methods.forEach([this](ObjString* name, Value method) {
+                markObject(name);
+                markValue(method);
+            });
+            break;
+        }
+        case ObjType::INSTANCE: {
+            auto* instance = static_cast<ObjInstance*>(object);
+            markObject(instance->klass);
+            markObject(instance->shape);
+            uint32_t inlineCount = std::min(instance->shape->slotCount, instance->inlineCapacity);
+            for (uint32_t i = 0; i < inlineCount; i++) {
+                markValue(instance->inlineSlots()[i]);
+            }
+            for (uint32_t i = inlineCount; i < instance->shape->slotCount; i++) {
+                markValue(instance->overflow[i - instance->inlineCapacity]);
+            }
+            break;
+        }
+        case ObjType::SHAPE: {
+            // Only the root shape and the shapes instances are using are
+            // reached directly; the rest are kept by the transitions leading
+            // to them
+            auto* shape = static_cast<ObjShape*>(object);
+            shape->slots.forEach([this](ObjString* name, Value) { markObject(name); });
+            shape->transitions.forEach([this](ObjString* name, Value next) {
+                markObject(name);
+                markValue(next);
+            });
+            break;
+        }
+        case ObjType::BOUND_METHOD: {
+            auto* bound = static_cast<ObjBoundMethod*>(object);
+            markValue(bound->receiver);
+            markObject(bound->method);
+            break;
+        }
+        case ObjType::ENVIRONMENT: {
+            auto* environment = static_cast<ObjEnvironment*>(object);
+            markObject(environment->enclosing);
+            for (uint32_t i = 0; i < environment->slotCount; i++) {
+                markValue(environment->slots()[i]);
+            }
+            break;
+        }
+        case ObjType::FUNCTION: {
+            auto* function = static_cast<ObjFunction*>(object);
+            markObject(function->name);
+            for (Value constant : function->chunk.constants) {
+                markValue(constant);
+            }
+            for (const PropertyCache& cache : function->chunk.caches) {
+                for (uint8_t i = 0; i < cache.count; i++) {
+                    markObject(cache.entries[i].shape);
+                    markObject(cache.entries[i].next);
+                    markObject(cache.entries[i].method);
+                }
+            }
+            break;
+        }
+        case ObjType::CLOSURE: {
+            auto* closure = static_cast<ObjClosure*>(object);
+            markObject(closure->function);
+            // Upvalues are filled in after the closure is allocated, so
+            // some may still be null
+            for (int i = 0; i < closure->function->upvalueCount; i++) {
+                markObject(closure->upvalues()[i]);
+            }
+            break;
+        }
+        case ObjType::UPVALUE: markValue(static_cast<ObjUpvalue*>(object)->closed); break;
+    }
+}
+
+// Collection
+
+void Heap::collect() {
+#ifdef LOX_STATS
+    uint64_t started = run_stats.enabled ? now_ns() : 0;
+#endif
+
+    // Leftover garbage from the last cycle has to go before the mark bits
+    // are reused
+    finishSweeping();
+
+    markedBytes = 0;
+    for (GcRoots* source : roots) {
+        source->markRoots(*this);
+    }
+    while (!grayStack.empty()) {
+        Obj* object = grayStack.back();
+        grayStack.pop_back();
+        blacken(object);
+    }
+    for (Obj* object : markedFrameObjects) {
+        object->frameMarked = false;
+    }
+    markedFrameObjects.clear();
+
+    // The intern table mustn't keep strings alive on its own
+    strings.removeIf([this](ObjString* string) { return !isMarked(string); });
+    sweepLargeObjects();
+
+    // Every page is swept lazily from here; the free lists are rebuilt as
+    // that happens
+    for (SizeClass& sizeClass : classes) {
+        sizeClass.freeList = nullptr;
+        sizeClass.unswept = sizeClass.pages;
+        sizeClass.pages = nullptr;
+    }
+
+#ifdef LOX_STATS
+    if (run_stats.enabled) {
+        run_stats.gc_collections++;
+        run_stats.gc_bytes_reclaimed += bytesAllocated - markedBytes;
+        run_stats.gc_live_bytes = markedBytes;
+        uint64_t pause = now_ns() - started;
+        run_stats.gc_pause_ns += pause;
+        run_stats.gc_max_pause_ns = std::max(run_stats.gc_max_pause_ns, pause);
+    }
+#endif
+    bytesAllocated = markedBytes;
+    nextGC = std::max(MIN_NEXT_GC, markedBytes * GROWTH_FACTOR);
+}
+
+// Frees the page's unmarked objects and puts every free cell on the size
+// class's free list, a bitmap word (64 cells) at a time
+void Heap::sweepPage(SizeClass& sizeClass, Page* page) {
+    size_t words = (page->cellCount + 63) / 64;
+    for (size_t word = words; word-- > 0;) {
+        uint64_t garbage = page->used[word] & ~page->marks[word];
+        while (garbage != 0) {
+            size_t index = word * 64 + std::countr_zero(garbage);
+            auto* object = reinterpret_cast<Obj*>(page->cells() + index * page->cellSize);
+            if (profiler != nullptr) profiler->freed(object);
+            destroy(object);
+            garbage &= garbage - 1;
+        }
+        page->used[word] &= page->marks[word];
+        page->marks[word] = 0;
+
+        uint64_t free = ~page->used[word];
+        if (word == words - 1 && page->cellCount % 64 != 0) {
+            free &= (uint64_t{1} << (page->cellCount % 64)) - 1;
+        }
+        // Highest first, so the list comes out in address order
+        while (free != 0) {
+            size_t index = word * 64 + (63 - std::countl_zero(free));
+            auto* cell = reinterpret_cast<FreeCell*>(page->cells() + index * page->cellSize);
+            cell->next = sizeClass.freeList;
+            sizeClass.freeList = cell;
+            free &= ~(uint64_t{1} << (index % 64));
+        }
+    }
+}
+
+void Heap::collectAll() {
+    collect();
+    finishSweeping();
+}
+
+void Heap::finishSweeping() {
+    for (SizeClass& sizeClass : classes) {
+        while (Page* page = sizeClass.unswept) {
+            sizeClass.unswept = page->next;
+            page->next = sizeClass.pages;
+            sizeClass.pages = page;
+            sweepPage(sizeClass, page);
+        }
+    }
+}
+
+// Few enough that sweeping them right away costs nothing worth deferring
+void Heap::sweepLargeObjects() {
+    LargeObject** link = &largeObjects;
+    while (LargeObject* header = *link) {
+        if (header->marked) {
+            header->marked = false;
+            link = &header->next;
+            continue;
+        }
+        *link = header->next;
+        if (profiler != nullptr) profiler->freed(header->object());
+        destroy(header->object());
+        ::operator delete(header);
+    }
+}
@@ -0,0 +1,61 @@
+#include "heap_profile.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <vector>
+
+#include "magic_enum.hpp"
+
+HeapProfiler::HeapProfiler(std::string script, size_t interval)
+    : script(std::move(script)), gaps(1.0 / static_cast<double>(std::max<size_t>(interval, 1))),
+      interval(static_cast<int64_t>(std::max<size_t>(interval, 1))), untilSample(nextGap()) {}
+
+int64_t HeapProfiler::nextGap() {
+    return std::max<int64_t>(1, static_cast<int64_t>(gaps(random)));
+}
+
+// An allocation bigger than the gaps can cover several sample points, and
+// is weighted by all of them
+void HeapProfiler::sample(const Obj* object) {
+    int64_t points = 0;
+    while (untilSample <= 0) {
+        points++;
+        untilSample += nextGap();
+    }
+    int line = lineSource ? lineSource() : 0;
+    samples[object] = {line, static_cast<uint64_t>(points * interval)};
+}
+
+void HeapProfiler::release(const Obj* object, bool retained) {
+    auto found = samples.find(object);
+    if (found == samples.end()) return;
+
+    Site& site = sites[{found->second.line, object->type}];
+    site.allocated += found->second.bytes;
+    if (retained) site.retained += found->second.bytes;
+    samples.erase(found);
+}
+
+bool HeapProfiler::write(const std::string& path) {
+    std::vector<const Obj*> live;
+    live.reserve(samples.size());
+    for (const auto& [object, sample] : samples) live.push_back(object);
+    for (const Obj* object : live) release(object, true);
+
+    std::FILE* out = std::fopen(path.c_str(), "w");
+    if (!out) return false;
+    for (const char* kind : {"allocated", "retained"}) {
+        bool isRetained = kind[0] == 'r';
+        for (const auto& [key, site] : sites) {
+            uint64_t bytes = isRetained ? site.retained : site.allocated;
+            if (bytes == 0) continue;
+            std::string type(magic_enum::enum_name(key.second));
+            std::transform(type.begin(), type.end(), type.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            std::fprintf(out, "%s;%s:%d;%s %llu\n", kind, script.c_str(), key.first, type.c_str(),
+                         static_cast<unsigned long long>(bytes));
+        }
+    }
+    return std::fclose(out) == 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "object.hpp"
+
+// Sampling allocation profiler behind `run --heap-profile`. The heap tells
+// it about every allocation; on average one in every `interval` bytes is
+// sampled and charged to the source line the program is running, weighted
+// by the interval so the totals estimate the real byte counts. The gaps
+// between samples are random (exponentially distributed, from a fixed
+// seed so runs repeat): a fixed gap would line up with a loop that
+// allocates the same objects each iteration and keep sampling the same
+// one. A sampled object that is freed counts as allocated; one still
+// reachable when the report is written counts as retained as well.
+//
+// The report is in the folded-stack format flamegraph.pl and speedscope
+// read: one `allocated;FILE:LINE;TYPE BYTES` or `retained;...` line per
+// site. Line 0 is code the runtime runs before the program starts
+class HeapProfiler {
+public:
+    HeapProfiler(std::string script, size_t interval);
+
+    // Where allocations are charged to; set by whichever of the compiler
+    // or an engine is running
+    void setLineSource(std::function<int()> source) { lineSource = std::move(source); }
+
+    // Called by the heap for every allocation, and for every object it
+    // frees. Cheap unless the allocation crosses the next sample point
+    void allocated(const Obj* object, size_t size) {
+        untilSample -= static_cast<int64_t>(size);
+        if (untilSample <= 0) sample(object);
+    }
+    void freed(const Obj* object) {
+        if (!samples.empty()) release(object, false);
+    }
+
+    // Charges every sample still live as retained and writes the report.
+    // Returns false if the file can't be written
+    bool write(const std::string& path);
+
+private:
+    struct Sample {
+        int line;
+        uint64_t bytes;
+    };
+
+    struct Site {
+        uint64_t allocated = 0;
+        uint64_t retained = 0;
+    };
+
+    std::string script;
+    std::mt19937_64 random;
+    std::exponential_distribution<double> gaps;
+    int64_t interval;
+    int64_t untilSample;
+    std::function<int()> lineSource;
+    // Sampled objects, by address, until they are freed. Their type is
+    // only read then: it isn't set yet when the heap reports the allocation
+    std::unordered_map<const Obj*, Sample> samples;
+    std::map<std::pair<int, ObjType>, Site> sites;
+
+    int64_t nextGap();
+    void sample(const Obj* object);
+    void release(const Obj* object, bool retained);
+};
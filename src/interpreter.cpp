@@ -0,0 +1,562 @@
+#include "interpreter.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "error.hpp"
+#include "natives.hpp"
+
+namespace {
+
+void write_line(const std::string& text) {
+    std::fwrite(text.data(), 1, text.size(), stdout);
+    std::fputc('\n', stdout);
+}
+
+}
+
+Interpreter::Interpreter(const Ast& ast)
+    : ast(ast), globals(ast.globalCount, Value::undefined()),
+      frameMemory(ast.frameFields.empty() ? nullptr : std::make_unique<std::byte[]>(FRAME_MEMORY_SIZE)),
+      tokenStrings(ast.tokens.size(), nullptr) {
+    heap.addRoots(this);
+    initString = heap.copyString("init");
+    stack.reserve(256);
+
+    // String literals are interned up front, like the constants the
+    // bytecode compiler makes of them
+    for (uint32_t token = 0; token < ast.tokens.size(); token++) {
+        if (ast.tokens[token].type == TokenType::STRING) tokenString(token);
+    }
+
+    // The resolver numbered the natives first, in this same order. Each
+    // name sits in its global slot until the native exists
+    uint32_t index = 0;
+    for (const NativeDef& native : natives()) {
+        ObjString* name = heap.copyString(native.name);
+        globals[index] = Value::object(name);
+        globals[index++] = Value::object(heap.make<ObjNative>(native.function, native.arity, name));
+    }
+}
+
+Interpreter::~Interpreter() {
+    // A runtime error unwinds without exiting the blocks it was in
+    releaseFrame(0);
+    heap.removeRoots(this);
+}
+
+void Interpreter::markRoots(Heap& heap) {
+    for (Value global : globals) {
+        heap.markValue(global);
+    }
+    heap.markObject(environment);
+    for (ObjEnvironment* saved : savedEnvironments) {
+        heap.markObject(saved);
+    }
+    for (Value value : stack) {
+        heap.markValue(value);
+    }
+    heap.markValue(returnValue);
+    for (ObjString* string : tokenStrings) {
+        heap.markObject(string);
+    }
+    heap.markObject(initString);
+}
+
+bool Interpreter::evaluate(NodeIndex expression, Value& result) {
+    try {
+        result = evaluate(expression);
+        return true;
+    }
+    catch (const RuntimeError& error) {
+        std::fflush(stdout);
+        runtime_error(error.line, error.message);
+        return false;
+    }
+}
+
+bool Interpreter::run() {
+    const Node& program = ast[ast.root];
+    try {
+        for (NodeIndex statement : ast.list(program.a, program.b)) {
+            execute(statement);
+        }
+        std::fflush(stdout);
+        return true;
+    }
+    catch (const RuntimeError& error) {
+        std::fflush(stdout);
+        runtime_error(error.line, error.message);
+        return false;
+    }
+}
+
+ObjString* Interpreter::tokenString(uint32_t token) {
+    ObjString*& string = tokenStrings[token];
+    if (string == nullptr) {
+        const Token& source = ast.tokens[token];
+        allocationLine = source.line;
+        string = heap.copyString(source.type == TokenType::STRING ? source.literal : source.lexeme);
+    }
+    return string;
+}
+
+// Statements
+
+Interpreter::ExecResult Interpreter::execute(NodeIndex index) {
+    const Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::EXPRESSION:
+            evaluate(node.a);
+            return ExecResult::NORMAL;
+
+        case NodeKind::PRINT:
+            write_line(stringify(evaluate(node.a)));
+            return ExecResult::NORMAL;
+
+        case NodeKind::VAR: {
+            define(index, node.a == NO_NODE ? Value::nil() : evaluate(node.a));
+            return ExecResult::NORMAL;
+        }
+
+        case NodeKind::BLOCK:
+            allocationLine = ast.line(node);
+            return executeBlock(ast.list(node.a, node.b),
+                                heap.makeEnvironment(environment, ast.bindings[index].slot));
+
+        case NodeKind::IF:
+            if (!evaluate(node.a).isFalsey()) return execute(node.b);
+            if (node.c != NO_NODE) return execute(node.c);
+            return ExecResult::NORMAL;
+
+        case NodeKind::WHILE:
+            while (!evaluate(node.a).isFalsey()) {
+                if (execute(node.b) == ExecResult::RETURN) return ExecResult::RETURN;
+            }
+            return ExecResult::NORMAL;
+
+        case NodeKind::FUNCTION: {
+            ObjString* name = tokenString(node.token);
+            allocationLine = ast.line(node);
+            auto* function = heap.make<ObjAstFunction>(index, environment, name, static_cast<int>(node.b), false);
+            define(index, Value::object(function));
+            return ExecResult::NORMAL;
+        }
+
+        case NodeKind::RETURN:
+            returnValue = node.a == NO_NODE ? Value::nil() : evaluate(node.a);
+            return ExecResult::RETURN;
+
+        case NodeKind::CLASS:
+            classDeclaration(index);
+            return ExecResult::NORMAL;
+
+        default:
+            // The parser only puts statements in statement position
+            return ExecResult::NORMAL;
+    }
+}
+
+Interpreter::ExecResult Interpreter::executeBlock(std::span<const NodeIndex> statements, ObjEnvironment* scope) {
+    savedEnvironments.push_back(environment);
+    environment = scope;
+    size_t frameMark = frameUsed;
+
+    ExecResult result = ExecResult::NORMAL;
+    for (NodeIndex statement : statements) {
+        result = execute(statement);
+        if (result == ExecResult::RETURN) break;
+    }
+
+    releaseFrame(frameMark);
+    environment = savedEnvironments.back();
+    savedEnvironments.pop_back();
+    return result;
+}
+
+// Instances sit back to back, each sized by its inline slots. A field
+// beyond those lives in the instance's overflow storage, which only its
+// destructor frees
+void Interpreter::releaseFrame(size_t mark) {
+    for (size_t offset = mark; offset < frameUsed;) {
+        auto* instance = reinterpret_cast<ObjInstance*>(frameMemory.get() + offset);
+        offset += Heap::instanceSize(instance->inlineCapacity);
+        std::destroy_at(instance);
+    }
+    frameUsed = mark;
+}
+
+void Interpreter::classDeclaration(NodeIndex index) {
+    const Node& node = ast[index];
+    ObjString* name = tokenString(node.token);
+
+    // The superclass, the scope holding it and the class itself stay on
+    // the stack until the class is defined
+    size_t base = stack.size();
+    ObjClass* superclass = nullptr;
+    if (node.a != NO_NODE) {
+        Value value = evaluate(node.a);
+        if (!is_obj_type(value, ObjType::CLASS)) {
+            fail(ast.line(ast[node.a]), "Superclass must be a class.");
+        }
+        superclass = static_cast<ObjClass*>(value.asObject());
+        push(value);
+    }
+
+    define(index, Value::nil());
+    allocationLine = ast.line(node);
+
+    // Methods of a subclass close over an extra scope holding `super`
+    ObjEnvironment* methodScope = environment;
+    if (superclass != nullptr) {
+        methodScope = heap.makeEnvironment(environment, 1);
+        methodScope->slots()[0] = Value::object(superclass);
+        push(Value::object(methodScope));
+    }
+
+    auto* klass = heap.make<ObjClass>(name);
+    klass->superclass = superclass;
+    push(Value::object(klass));
+    for (NodeIndex methodIndex : ast.list(node.b, node.c)) {
+        const Node& method = ast[methodIndex];
+        ObjString* methodName = tokenString(method.token);
+        auto* function = heap.make<ObjAstFunction>(methodIndex, methodScope, methodName,
+                                                   static_cast<int>(method.b), methodName == initString);
+        klass->methods.set(methodName, Value::object(function));
+    }
+    stack.resize(base);
+
+    define(index, Value::object(klass));
+}
+
+// Expressions
+
+Value Interpreter::evaluate(NodeIndex index) {
+    const Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::NUMBER: return Value::number(Ast::number(node));
+        case NodeKind::STRING: return Value::object(tokenString(node.token));
+        case NodeKind::TRUE: return Value::boolean(true);
+        case NodeKind::FALSE: return Value::boolean(false);
+        case NodeKind::NIL: return Value::nil();
+        case NodeKind::GROUPING: return evaluate(node.a);
+
+        case NodeKind::UNARY: {
+            Value operand = evaluate(node.a);
+            if (node.op == TokenType::BANG) return Value::boolean(operand.isFalsey());
+            return Value::number(-checkNumber(operand, ast.line(node)));
+        }
+
+        case NodeKind::BINARY: return binary(node);
+
+        case NodeKind::LOGICAL: {
+            Value left = evaluate(node.a);
+            if (node.op == TokenType::OR) {
+                if (!left.isFalsey()) return left;
+            }
+            else if (left.isFalsey()) {
+                return left;
+            }
+            return evaluate(node.b);
+        }
+
+        case NodeKind::VARIABLE: return lookUp(index);
+
+        case NodeKind::ASSIGN: {
+            Value value = evaluate(node.a);
+            assign(index, value);
+            return value;
+        }
+
+        case NodeKind::CALL: return call(index);
+        case NodeKind::GET: return getProperty(node);
+
+        case NodeKind::SET: {
+            // Interned up front: the value below is only held in a local
+            ObjString* name = tokenString(node.token);
+            Value object = evaluate(node.a);
+            if (!is_obj_type(object, ObjType::INSTANCE)) {
+                fail(ast.line(node), "Only instances have fields.");
+            }
+            push(object);
+            Value value = evaluate(node.b);
+            // Both stay on the stack: adding a field can allocate a shape
+            push(value);
+            allocationLine = ast.line(node);
+            heap.setField(static_cast<ObjInstance*>(object.asObject()), name, value);
+            pop();
+            pop();
+            return value;
+        }
+
+        case NodeKind::THIS: return lookUp(index);
+        case NodeKind::SUPER: return superProperty(index);
+
+        default:
+            return Value::nil();
+    }
+}
+
+Value Interpreter::binary(const Node& node) {
+    // The left operand waits on the stack while the right one is evaluated
+    push(evaluate(node.a));
+    Value right = evaluate(node.b);
+    Value left = pop();
+    int line = ast.line(node);
+
+    switch (node.op) {
+        case TokenType::PLUS:
+            if (left.isNumber() && right.isNumber()) {
+                return Value::number(left.asNumber() + right.asNumber());
+            }
+            if (is_string(left) && is_string(right)) {
+                allocationLine = line;
+                // The result may be a rope pointing at both, so they have
+                // to survive its allocation
+                push(left);
+                push(right);
+                Value joined = Value::object(heap.concatenate(left.asObject(), right.asObject()));
+                stack.resize(stack.size() - 2);
+                return joined;
+            }
+            fail(line, "Operands must be two numbers or two strings.");
+        case TokenType::MINUS:
+            checkNumbers(left, right, line);
+            return Value::number(left.asNumber() - right.asNumber());
+        case TokenType::STAR:
+            checkNumbers(left, right, line);
+            return Value::number(left.asNumber() * right.asNumber());
+        case TokenType::SLASH:
+            checkNumbers(left, right, line);
+            return Value::number(left.asNumber() / right.asNumber());
+        case TokenType::GREATER:
+            checkNumbers(left, right, line);
+            return Value::boolean(left.asNumber() > right.asNumber());
+        case TokenType::GREATER_EQUAL:
+            checkNumbers(left, right, line);
+            return Value::boolean(left.asNumber() >= right.asNumber());
+        case TokenType::LESS:
+            checkNumbers(left, right, line);
+            return Value::boolean(left.asNumber() < right.asNumber());
+        case TokenType::LESS_EQUAL:
+            checkNumbers(left, right, line);
+            return Value::boolean(left.asNumber() <= right.asNumber());
+        case TokenType::EQUAL_EQUAL: return Value::boolean(left == right);
+        case TokenType::BANG_EQUAL: return Value::boolean(!(left == right));
+        default: return Value::nil();
+    }
+}
+
+Value Interpreter::call(NodeIndex index) {
+    const Node& node = ast[index];
+    // Callee and arguments go on the stack in order; the callee's slot is
+    // reused for the result once the call returns
+    size_t base = stack.size();
+    push(evaluate(node.a));
+    for (NodeIndex argument : ast.list(node.b, node.c)) {
+        push(evaluate(argument));
+    }
+
+    // The analysis only knows the class by name, so the callee is checked.
+    // Class names are unique where it applies, so the name is enough
+    Value result;
+    Value callee = stack[base];
+    uint32_t fields = ast.frameFields.empty() ? NOT_IN_FRAME : ast.frameFields[index];
+    size_t size = Heap::instanceSize(fields);
+    if (fields != NOT_IN_FRAME && is_obj_type(callee, ObjType::CLASS) &&
+        static_cast<ObjClass*>(callee.asObject())->name == tokenString(ast[node.a].token) &&
+        frameUsed + size <= FRAME_MEMORY_SIZE) {
+        auto* klass = static_cast<ObjClass*>(callee.asObject());
+        allocationLine = ast.line(node);
+        ObjInstance* instance = heap.makeInstanceIn(frameMemory.get() + frameUsed, klass, fields);
+        frameUsed += size;
+        result = construct(klass, instance, base, static_cast<int>(node.c), ast.line(node));
+    }
+    else {
+        result = callValue(callee, base, static_cast<int>(node.c), ast.line(node));
+    }
+    stack.resize(base);
+    return result;
+}
+
+Value Interpreter::callValue(Value callee, size_t base, int argCount, int line) {
+    if (callee.isObject()) {
+        switch (callee.asObject()->type) {
+            case ObjType::NATIVE: {
+                auto* native = static_cast<ObjNative*>(callee.asObject());
+                if (argCount != native->arity) {
+                    fail(line, "Expected " + std::to_string(native->arity) + " arguments but got " +
+                                   std::to_string(argCount) + ".");
+                }
+                return native->function(argCount, stack.data() + base + 1);
+            }
+
+            case ObjType::AST_FUNCTION:
+                return callFunction(static_cast<ObjAstFunction*>(callee.asObject()), Value::nil(), base,
+                                    argCount, line);
+
+            case ObjType::CLASS: {
+                auto* klass = static_cast<ObjClass*>(callee.asObject());
+                allocationLine = line;
+                return construct(klass, heap.makeInstance(klass), base, argCount, line);
+            }
+
+            case ObjType::BOUND_METHOD: {
+                auto* bound = static_cast<ObjBoundMethod*>(callee.asObject());
+                return callFunction(static_cast<ObjAstFunction*>(bound->method), bound->receiver, base,
+                                    argCount, line);
+            }
+
+            default:
+                break;
+        }
+    }
+    fail(line, "Can only call functions and classes.");
+}
+
+Value Interpreter::construct(ObjClass* klass, ObjInstance* instance, size_t base, int argCount, int line) {
+    Value receiver = Value::object(instance);
+    stack[base] = receiver;
+    if (ObjAstFunction* initializer = findMethod(klass, initString)) {
+        return callFunction(initializer, receiver, base, argCount, line);
+    }
+    if (argCount != 0) {
+        fail(line, "Expected 0 arguments but got " + std::to_string(argCount) + ".");
+    }
+    return receiver;
+}
+
+Value Interpreter::callFunction(ObjAstFunction* function, Value receiver, size_t base, int argCount, int line) {
+    if (argCount != function->arity) {
+        fail(line, "Expected " + std::to_string(function->arity) + " arguments but got " +
+                       std::to_string(argCount) + ".");
+    }
+    if (callDepth == MAX_CALL_DEPTH) {
+        fail(line, "Stack overflow.");
+    }
+    allocationLine = line;
+
+    // A method call gets `this` in a scope between its closure and its
+    // body. It waits on the stack while the call's own scope is allocated
+    ObjEnvironment* enclosing = function->closure;
+    if (!receiver.isNil()) {
+        enclosing = heap.makeEnvironment(enclosing, 1);
+        enclosing->slots()[0] = receiver;
+        push(Value::object(enclosing));
+    }
+
+    // Parameters take the first slots of the call's scope
+    const Node& declaration = ast[function->declaration];
+    ObjEnvironment* scope = heap.makeEnvironment(enclosing, ast.bindings[declaration.c].slot);
+    std::copy_n(stack.data() + base + 1, argCount, scope->slots());
+    stack.resize(base + 1 + argCount);
+
+    const Node& body = ast[declaration.c];
+    callDepth++;
+    ExecResult result = executeBlock(ast.list(body.a, body.b), scope);
+    callDepth--;
+
+    if (function->isInitializer) return receiver;
+    return result == ExecResult::RETURN ? returnValue : Value::nil();
+}
+
+Value Interpreter::getProperty(const Node& node) {
+    Value object = evaluate(node.a);
+    if (!is_obj_type(object, ObjType::INSTANCE)) {
+        fail(ast.line(node), "Only instances have properties.");
+    }
+
+    auto* instance = static_cast<ObjInstance*>(object.asObject());
+    push(object);
+    ObjString* name = tokenString(node.token);
+    if (const Value* field = instance->field(name)) {
+        pop();
+        return *field;
+    }
+
+    if (ObjAstFunction* method = findMethod(instance->klass, name)) {
+        allocationLine = ast.line(node);
+        Value bound = Value::object(heap.make<ObjBoundMethod>(object, method));
+        pop();
+        return bound;
+    }
+    fail(ast.line(node), "Undefined property '" + std::string(name->view()) + "'.");
+}
+
+// `super` is resolved like a variable; `this` always sits in the scope
+// just inside it
+Value Interpreter::superProperty(NodeIndex index) {
+    const Node& node = ast[index];
+    const Binding& binding = ast.bindings[index];
+    ObjEnvironment* scope = environment;
+    for (uint32_t hops = binding.depth; hops > 1; hops--) {
+        scope = scope->enclosing;
+    }
+    Value receiver = scope->slots()[0];
+    auto* superclass = static_cast<ObjClass*>(scope->enclosing->slots()[binding.slot].asObject());
+
+    ObjString* name = tokenString(node.token);
+    ObjAstFunction* method = findMethod(superclass, name);
+    if (method == nullptr) {
+        fail(ast.line(node), "Undefined property '" + std::string(name->view()) + "'.");
+    }
+    allocationLine = ast.line(node);
+    return Value::object(heap.make<ObjBoundMethod>(receiver, method));
+}
+
+// Variables
+
+Value& Interpreter::variable(NodeIndex node) {
+    const Binding& binding = ast.bindings[node];
+    if (binding.depth == GLOBAL) return globals[binding.slot];
+
+    ObjEnvironment* scope = environment;
+    for (uint32_t hops = binding.depth; hops > 0; hops--) {
+        scope = scope->enclosing;
+    }
+    return scope->slots()[binding.slot];
+}
+
+// Locals are always initialised by the time the resolver lets them be
+// read; only globals can be read before anything defined them
+Value Interpreter::lookUp(NodeIndex node) {
+    Value value = variable(node);
+    if (value.isUndefined()) {
+        fail(ast.line(ast[node]), "Undefined variable '" + ast.token(ast[node]).lexeme + "'.");
+    }
+    return value;
+}
+
+void Interpreter::assign(NodeIndex node, Value value) {
+    Value& slot = variable(node);
+    if (slot.isUndefined()) {
+        fail(ast.line(ast[node]), "Undefined variable '" + ast.token(ast[node]).lexeme + "'.");
+    }
+    slot = value;
+}
+
+void Interpreter::define(NodeIndex node, Value value) {
+    variable(node) = value;
+}
+
+ObjAstFunction* Interpreter::findMethod(ObjClass* klass, ObjString* name) {
+    for (; klass != nullptr; klass = klass->superclass) {
+        if (const Value* found = klass->methods.find(name)) return static_cast<ObjAstFunction*>(found->asObject());
+    }
+    return nullptr;
+}
+
+// Errors
+
+void Interpreter::fail(int line, const std::string& message) {
+    throw RuntimeError(line, message);
+}
+
+double Interpreter::checkNumber(Value operand, int line) {
+    if (!operand.isNumber()) fail(line, "Operand must be a number.");
+    return operand.asNumber();
+}
+
+void Interpreter::checkNumbers(Value left, Value right, int line) {
+    if (!left.isNumber() || !right.isNumber()) fail(line, "Operands must be numbers.");
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "object.hpp"
+#include "value.hpp"
+
+// Thrown to unwind out of the program after a runtime error. Lox has no way
+// to catch one, so it always ends the run
+struct RuntimeError : std::exception {
+    int line;
+    std::string message;
+
+    RuntimeError(int line, std::string message) : line(line), message(std::move(message)) {}
+};
+
+// Tree-walking evaluator over a flat Ast that resolve() has run on. Operands that are still needed
+// while another subexpression runs are kept on an explicit value stack
+// rather than in C++ locals, so everything a collector would have to find
+// lives in one place
+class Interpreter : public GcRoots {
+public:
+    explicit Interpreter(const Ast& ast);
+    ~Interpreter();
+
+    Interpreter(const Interpreter&) = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
+
+    // Evaluates a single expression (the `evaluate` command). Returns false
+    // after reporting a runtime error
+    bool evaluate(NodeIndex expression, Value& result);
+
+    // Executes a PROGRAM (the `run` command). Returns false after reporting
+    // a runtime error
+    bool run();
+
+    // Line of the code that last allocated, for the heap profiler
+    int currentLine() const { return allocationLine; }
+
+private:
+    // How control leaves a statement: normally, or by a `return` unwinding
+    // to the nearest call. The returned value is left in returnValue
+    enum class ExecResult : uint8_t { NORMAL, RETURN };
+
+    // Deep enough for any sensible recursion, shallow enough that the C++
+    // frames behind each Lox call fit comfortably on the native stack
+    static constexpr int MAX_CALL_DEPTH = 2048;
+
+    const Ast& ast;
+    // Indexed by the resolver's global numbers; unassigned ones hold
+    // Value::undefined()
+    std::vector<Value> globals;
+    // Innermost local scope, or nullptr at the top level
+    ObjEnvironment* environment = nullptr;
+    std::vector<Value> stack;
+    // Environments to return to once the current block or call finishes
+    std::vector<ObjEnvironment*> savedEnvironments;
+    Value returnValue;
+    int callDepth = 0;
+    // Set by every node that can allocate, just before it does
+    int allocationLine = 0;
+    // Instances find_frame_allocations() showed can't outlive their block
+    // are built here instead of on the heap, and given back when the block
+    // exits. Once it is full they go on the heap as usual
+    static constexpr size_t FRAME_MEMORY_SIZE = 256 * 1024;
+    std::unique_ptr<std::byte[]> frameMemory;
+    size_t frameUsed = 0;
+
+    // Interned property name or string literal per token, filled in on
+    // first use
+    std::vector<ObjString*> tokenStrings;
+    ObjString* initString = nullptr;
+
+    ObjString* tokenString(uint32_t token);
+    void markRoots(Heap& heap) override;
+
+    ExecResult execute(NodeIndex index);
+    ExecResult executeBlock(std::span<const NodeIndex> statements, ObjEnvironment* scope);
+    // Destroys the frame instances built since `mark` and gives their memory back
+    void releaseFrame(size_t mark);
+    void classDeclaration(NodeIndex index);
+
+    Value evaluate(NodeIndex index);
+    Value binary(const Node& node);
+    Value call(NodeIndex index);
+    Value callValue(Value callee, size_t base, int argCount, int line);
+    Value construct(ObjClass* klass, ObjInstance* instance, size_t base, int argCount, int line);
+    Value callFunction(ObjAstFunction* function, Value receiver, size_t base, int argCount, int line);
+    Value getProperty(const Node& node);
+    Value superProperty(NodeIndex index);
+
+    // Reading and writing through a node's Binding
+    Value& variable(NodeIndex node);
+    Value lookUp(NodeIndex node);
+    void assign(NodeIndex node, Value value);
+    void define(NodeIndex node, Value value);
+    static ObjAstFunction* findMethod(ObjClass* klass, ObjString* name);
+
+    void push(Value value) { stack.push_back(value); }
+    Value pop() {
+        Value value = stack.back();
+        stack.pop_back();
+        return value;
+    }
+
+    [[noreturn]] static void fail(int line, const std::string& message);
+    static double checkNumber(Value operand, int line);
+    static void checkNumbers(Value left, Value right, int line);
+};
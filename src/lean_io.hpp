@@ -0,0 +1,99 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+
+#include "token.hpp"
+
+// Minimal replacements for the iostreams the interpreter uses, for the
+// LEAN_STARTUP build. Nothing here needs static initialisation, so a
+// statically linked binary goes from execve to main() almost immediately
+
+// Buffered writer straight onto a file descriptor. Flushes when the buffer
+// fills up and on destruction, which std::exit also triggers for statics
+class FdWriter {
+public:
+    explicit FdWriter(int fd) : fd(fd) {}
+    ~FdWriter() { flush(); }
+
+    FdWriter(const FdWriter&) = delete;
+    FdWriter& operator=(const FdWriter&) = delete;
+
+    FdWriter& operator<<(std::string_view text) {
+        if (used + text.size() > sizeof(buffer)) {
+            flush();
+            if (text.size() > sizeof(buffer)) {
+                writeAll(text.data(), text.size());
+                return *this;
+            }
+        }
+        text.copy(buffer + used, text.size());
+        used += text.size();
+        return *this;
+    }
+
+    FdWriter& operator<<(char c) {
+        return *this << std::string_view(&c, 1);
+    }
+
+    FdWriter& operator<<(const Token& token) {
+        return *this << token_type_name(token.type) << ' ' << token.lexeme << ' '
+            << token_literal(token);
+    }
+
+    void flush() {
+        writeAll(buffer, used);
+        used = 0;
+    }
+
+private:
+    int fd;
+    std::size_t used = 0;
+    char buffer[64 * 1024];
+
+    void writeAll(const char* data, std::size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written <= 0) return;
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+// Reads a whole file with a single fstat-sized read where possible.
+// Returns false if the file can't be opened
+inline bool read_file_raw(const char* filename, std::string& contents) {
+    int fd = ::open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat info;
+    std::size_t size = (::fstat(fd, &info) == 0 && info.st_size > 0) ? info.st_size : 0;
+    contents.resize(size);
+
+    std::size_t filled = 0;
+    while (true) {
+        // Once the expected size is in, probe for anything appended since
+        // the fstat (or for pipes, which report no size) without reallocating
+        if (filled == contents.size()) {
+            char probe[4096];
+            ssize_t got = ::read(fd, probe, sizeof(probe));
+            if (got <= 0) break;
+            contents.append(probe, got);
+            filled += got;
+            continue;
+        }
+        ssize_t got = ::read(fd, contents.data() + filled, contents.size() - filled);
+        if (got <= 0) break;
+        filled += got;
+    }
+    contents.resize(filled);
+    ::close(fd);
+    return true;
+}
@@ -1,315 +1,401 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
+#include <cstdlib>
+#include <functional>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
-#include <cctype>
-// Regular enum classes can't return the keyword the enum
-// associates with the integer value
-#include "magic_enum.hpp"
-
-bool had_error = false;
-std::string read_file_contents(const std::string& filename);
-void error(int line, const std::string& message);
-void report(int line, const std::string& where, const std::string& message);
-
-// Define the different kinds of tokens our language supports
-enum class TokenType {
-    // Single-character tokens
-    LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
-    COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR,
-
-    // One or two character tokens
-    BANG, BANG_EQUAL,
-    EQUAL, EQUAL_EQUAL,
-    GREATER, GREATER_EQUAL,
-    LESS, LESS_EQUAL,
-
-    // Literals.
-    IDENTIFIER, STRING, NUMBER,
 
-    // Keywords.
-    IF, ELSE, WHILE, FOR, RETURN, TRUE, FALSE,
-
-    // End-of-file.
-    END_OF_FILE
-};
-
-struct Token {
-    TokenType     type;
-    std::string   lexeme;
-    std::string   literal;
-    int           line;
-
-    Token(TokenType type, const std::string& lexeme, const std::string& literal, int line)
-        : type(type), lexeme(lexeme), literal(literal), line(line) {}
-};
+#ifdef LOX_LEAN_IO
+#include "lean_io.hpp"
+#else
+#include <iostream>
+#include "watch.hpp"
+#endif
+
+#include "ast.hpp"
+#include "bytecode_cache.hpp"
+#include "compiler.hpp"
+#include "error.hpp"
+#include "escape.hpp"
+#include "file.hpp"
+#include "heap_profile.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "parser.hpp"
+#include "peephole.hpp"
+#include "resolver.hpp"
+#include "pipeline.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "token.hpp"
+#include "trace.hpp"
+#include "vm.hpp"
+
+#ifdef LOX_LEAN_IO
+// No iostreams at all in the lean build; stdout is flushed once at exit
+static FdWriter out(STDOUT_FILENO);
+static FdWriter err(STDERR_FILENO);
+#else
+static std::ostream& out = std::cout;
+static std::ostream& err = std::cerr;
+#endif
 
-class Scanner {
-public:
-    /* C++ curiosity: whenever you write a constructor with one parameter,
-    it can be used as a 'converting constructor', i.e. 
-    if class Foo has a constructor of the form Foo(int x) {}, then
-    if for some method bar(Foo foo), we can simply pass the int to bar
-    and the compiler will make the implicit conversion
-    (as long as there's only one)
-    
-    Using the keyword 'explicit' prevents the compiler from doing that,
-    making the programme's behaviour a bit more predictable */
-    explicit Scanner(const std::string& source) : source(source) {}
+int main(int argc, char *argv[]) {
+#ifndef LOX_LEAN_IO
+    // Disable output buffering
+    std::cout << std::unitbuf;
+    std::cerr << std::unitbuf;
+#endif
 
-    std::vector<Token> scanTokens() {
-        while (!isAtEnd()) {
-            start = current;
-            scanToken();
-        }
-        tokens.push_back(Token(TokenType::END_OF_FILE, "", "", line));
-        return tokens;
+    if (argc < 3) {
+        err << "Usage: ./your_program tokenize [--watch] [--stats[=FILE]] [--trace=FILE] <filename>\n"
+            << "       ./your_program parse <filename>\n"
+            << "       ./your_program evaluate <filename>\n"
+            << "       ./your_program run [--engine=ast|vm] [--cache] [--no-fold] [--no-peephole] [--stats[=FILE]]\n"
+            << "           [--heap-profile[=FILE]] [--heap-sample=BYTES] [--dump-opcode-pairs[=FILE]] <filename>\n";
+        return 1;
     }
 
-private:
-    const std::string source;
-    std::vector<Token> tokens;
-    int start = 0;
-    int current = 0;
-    int line = 1;
-
-    bool isAtEnd() const {
-        return current >= source.size();
-    }
+    const std::string command = argv[1];
 
-    void scanToken() {
-        char c = advance();
-        switch (c) {
-            case '(': addToken(TokenType::LEFT_PAREN); break;
-            case ')': addToken(TokenType::RIGHT_PAREN); break;
-            case '{': addToken(TokenType::LEFT_BRACE); break;
-            case '}': addToken(TokenType::RIGHT_BRACE); break;
-            case ',': addToken(TokenType::COMMA); break;
-            case '.': addToken(TokenType::DOT); break;
-            case '-': addToken(TokenType::MINUS); break;
-            case '+': addToken(TokenType::PLUS); break;
-            case ';': addToken(TokenType::SEMICOLON); break;
-            case '*': addToken(TokenType::STAR); break;
-            case '!':
-                addToken(match('=') ? TokenType::BANG_EQUAL : TokenType::BANG);
-                break;
-            case '=':
-                addToken(match('=') ? TokenType::EQUAL_EQUAL : TokenType::EQUAL);
-                break;
-            case '<':
-                addToken(match('=') ? TokenType::LESS_EQUAL : TokenType::LESS);
-                break;
-            case '>':
-                addToken(match('=') ? TokenType::GREATER_EQUAL : TokenType::GREATER);
-                break;
+    if (command == "tokenize") {
+        std::string filename;
+        bool watch = false;
+        bool stats = false;
+        std::string stats_path;
+        std::string trace_path;
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg == "--watch") {
+                watch = true;
+            }
+            else if (arg == "--stats") {
+                stats = true;
+            }
+            else if (arg.starts_with("--stats=")) {
+                stats = true;
+                stats_path = arg.substr(8);
+            }
+            else if (arg.starts_with("--trace=")) {
+                trace_path = arg.substr(8);
+            }
+            else {
+                filename = arg;
+            }
+        }
+        if (filename.empty()) {
+            err << "Usage: ./your_program tokenize [--watch] [--stats[=FILE]] [--trace=FILE] <filename>\n";
+            return 1;
+        }
 
-            // Two slashes make a comment in Lox: the scanner advances until
-            // it finds the line end
-            case '/':
-                if (match('/')) {
-                    while (peek() != '\n' && !isAtEnd()) advance();
-                }
-                else {
-                    addToken(TokenType::SLASH);
-                }
-                break;
+        if (watch) {
+#ifdef LOX_LEAN_IO
+            err << "--watch is not available in the lean startup build\n";
+            return 1;
+#else
+            return watch_directory(filename);
+#endif
+        }
 
-            case ' ':
-            case '\r':
-            case '\t':
-                // Skip whitespace
-                break;
-            case '\n':
-                line++;
-                break;
+        if (stats) {
+#ifdef LOX_STATS
+            run_stats.enabled = true;
+#else
+            err << "--stats was compiled out of this build (LOX_STATS=OFF)\n";
+            return 1;
+#endif
+        }
 
-            case '"':
-                string();
-                break;
+        if (!trace_path.empty() && !chrome_trace.open(trace_path)) {
+            err << "Cannot write trace to " << trace_path << '\n';
+            return 1;
+        }
 
-            default:
-                if (isDigit(c)) {
-                    number();
-                }
-                else if (isAlpha(c)) {
-                    identifier();
-                }
-                else {
-                    error(line, "Unexpected character");
+        std::string file_contents;
+        {
+            LOX_STATS_PHASE(Phase::READ);
+            LOX_TRACE_SPAN("read_file_contents");
+            file_contents = read_file_contents(filename);
+        }
+        LOX_STATS_BYTES(file_contents.size());
+
+        std::vector<Token> tokens;
+        if (file_contents.size() >= PIPELINE_MIN_BYTES) {
+            // Big inputs get printed while the rest is still being scanned
+            scan_pipelined(file_contents, [](const std::vector<Token>& batch) {
+                LOX_STATS_PHASE(Phase::FORMAT);
+                LOX_TRACE_SPAN("format");
+                for (const auto& token : batch) {
+                    LOX_STATS_COUNT_TOKEN(token.type);
+                    out << token << '\n';
                 }
-                break;
+            });
         }
-    }
-
-    // Returns the current character and advances the pointer
-    // Programming nuance: current++ executes the statement involving
-    // the incremented variable then increments
-    // ++current increments THEN executes
-    char advance() {
-        return source[current++];
-    }
-
-    // Some (simple) tokens do not have literal values, e.g. braces, semicolons
-    void addToken(TokenType type) {
-        addToken(type, "");
-    }
-
-    // But some tokens do, e.g. strings, numerics, necessitating function overloading
-    void addToken(TokenType type, const std::string& literal) {
-        std::string text = source.substr(start, current - start);
-        tokens.push_back(Token(type, text, literal, line));
-    }
-
-    // Conditionally consumes the next character if it matches `expected`
-    bool match(char expected) {
-        if (isAtEnd() || source[current] != expected) return false;
-        current++;
-        return true;
-    }
-
-    // Looks at the current character without consuming it
-    char peek() const {
-        if (isAtEnd()) return '\0';
-        return source[current];
-    }
-
-    // Peeks at the next character
-    char peekNext() const {
-        if (current + 1 >= source.size()) return '\0';
-        return source[current + 1];
-    }
-
-    // Processes a string literal
-    void string() {
-        while (peek() != '"' && !isAtEnd()) {
-            if (peek() == '\n') line++;
-            advance();
+        else if (!file_contents.empty()) {
+            {
+                LOX_STATS_PHASE(Phase::SCAN);
+                Scanner scanner(file_contents);
+                tokens = scanner.scanTokens();
+            }
+            LOX_STATS_PHASE(Phase::FORMAT);
+            LOX_TRACE_SPAN("format");
+            for (const auto& token : tokens) {
+                LOX_STATS_COUNT_TOKEN(token.type);
+                out << token << '\n';
+            }
         }
 
-        if (isAtEnd()) {
-            error(line, "Unterminated string.");
-            return;
+        // Teardown is done explicitly so --stats can see what it costs
+        {
+            LOX_STATS_PHASE(Phase::EXIT);
+            LOX_TRACE_SPAN("exit");
+            std::vector<Token>().swap(tokens);
+            std::string().swap(file_contents);
+            out.flush();
         }
 
-        // For the closing quote
-        advance();
-
-        // Extract the string value (without the quotes)
-        std::string value = source.substr(start + 1, current - start - 2);
-        addToken(TokenType::STRING, value);
-    }
-
-    // Process a number literal
-    void number() {
-        while (isDigit(peek())) advance();
-
-        // Look for a fractional part
-        if (peek() == '.' && isDigit(peekNext())) {
-            advance();  // Consume the dot
-            while (isDigit(peek())) advance();
+        if (stats && !report_stats(stats_path)) {
+            err << "Cannot write stats to " << stats_path << '\n';
         }
+        chrome_trace.close();
+        if (had_error) {
+            std::exit(65);
+        }
+        
+    } else if (command == "parse") {
+        std::string file_contents = read_file_contents(argv[2]);
+        Scanner scanner(file_contents);
+        Parser parser(scanner.scanTokens());
+        Ast ast = parser.parseExpression();
+        if (had_error) {
+            std::exit(65);
+        }
+        out << print_ast(ast, ast.root) << '\n';
 
-        std::string numberStr = source.substr(start, current - start);
-        addToken(TokenType::NUMBER, numberStr);
-    }
-
-    // Process an identifier or keyword
-    void identifier() {
-        while (isAlphaNumeric(peek())) advance();
-
-        std::string text = source.substr(start, current - start);
-        TokenType type = identifierType(text);
-        addToken(type);
-    }
-
-    // Determine if the identifier is a reserved keyword
-    TokenType identifierType(const std::string& text) {
-        if (text == "if") return TokenType::IF;
-        if (text == "else") return TokenType::ELSE;
-        if (text == "while") return TokenType::WHILE;
-        if (text == "for") return TokenType::FOR;
-        if (text == "return") return TokenType::RETURN;
-        if (text == "true") return TokenType::TRUE;
-        if (text == "false") return TokenType::FALSE;
-        return TokenType::IDENTIFIER;
-    }
-
-    bool isDigit(char c) {
-        return std::isdigit(static_cast<unsigned char>(c));
-    }
-
-    bool isAlpha(char c) {
-        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
-    }
-
-    bool isAlphaNumeric(char c) {
-        return isAlpha(c) || isDigit(c);
-    }
-};
-
-int main(int argc, char *argv[]) {
-    // Disable output buffering
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
+    } else if (command == "evaluate") {
+        std::string file_contents = read_file_contents(argv[2]);
+        Scanner scanner(file_contents);
+        Parser parser(scanner.scanTokens());
+        Ast ast = parser.parseExpression();
+        resolve(ast);
+        if (had_error) {
+            std::exit(65);
+        }
+        Interpreter interpreter(ast);
+        Value result;
+        if (!interpreter.evaluate(ast.root, result)) {
+            std::exit(70);
+        }
+        out << stringify(result) << '\n';
+
+    } else if (command == "run") {
+        std::string filename;
+        std::string engine = "ast";
+        bool fold = true;
+        bool cache = false;
+        bool peephole = true;
+        bool dump_pairs = false;
+        std::string pairs_path;
+        bool stats = false;
+        std::string stats_path;
+        std::string heap_profile_path;
+        size_t heap_sample_bytes = 4096;
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            if (arg.starts_with("--engine=")) {
+                engine = arg.substr(9);
+            }
+            else if (arg == "--no-fold") {
+                fold = false;
+            }
+            else if (arg == "--cache") {
+                cache = true;
+            }
+            else if (arg == "--no-peephole") {
+                peephole = false;
+            }
+            else if (arg == "--dump-opcode-pairs") {
+                dump_pairs = true;
+            }
+            else if (arg.starts_with("--dump-opcode-pairs=")) {
+                dump_pairs = true;
+                pairs_path = arg.substr(20);
+            }
+            else if (arg == "--stats") {
+                stats = true;
+            }
+            else if (arg.starts_with("--stats=")) {
+                stats = true;
+                stats_path = arg.substr(8);
+            }
+            else if (arg == "--heap-profile") {
+                heap_profile_path = "heap.folded";
+            }
+            else if (arg.starts_with("--heap-profile=")) {
+                heap_profile_path = arg.substr(15);
+            }
+            else if (arg.starts_with("--heap-sample=")) {
+                heap_sample_bytes = std::strtoull(arg.c_str() + 14, nullptr, 10);
+            }
+            else {
+                filename = arg;
+            }
+        }
+        // The cache and the opcode profile are about bytecode, which only
+        // the VM runs
+        if (filename.empty() || (engine != "ast" && engine != "vm") || ((cache || dump_pairs) && engine != "vm") ||
+            heap_sample_bytes == 0) {
+            err << "Usage: ./your_program run [--engine=ast|vm] [--cache] [--no-fold] [--no-peephole] [--stats[=FILE]]\n"
+                << "           [--heap-profile[=FILE]] [--heap-sample=BYTES] [--dump-opcode-pairs[=FILE]] <filename>\n";
+            return 1;
+        }
 
-    if (argc < 3) {
-        std::cerr << "Usage: ./your_program tokenize <filename>" << std::endl;
-        return 1;
-    }
+        // Samples one allocation per heap_sample_bytes, charged to the line
+        // that made it; the report is written once the program finishes
+        std::optional<HeapProfiler> heap_profiler;
+        if (!heap_profile_path.empty()) {
+            heap_profiler.emplace(filename, heap_sample_bytes);
+            heap.setProfiler(&*heap_profiler);
+        }
+        auto profile_lines = [&](std::function<int()> source) {
+            if (heap_profiler) heap_profiler->setLineSource(std::move(source));
+        };
+        auto write_heap_profile = [&] {
+            if (!heap_profiler) return;
+            // Whatever is unreachable now was allocated but not retained
+            heap.collectAll();
+            heap.setProfiler(nullptr);
+            if (!heap_profiler->write(heap_profile_path)) {
+                err << "Cannot write heap profile to " << heap_profile_path << '\n';
+            }
+        };
+
+        if (stats) {
+#ifdef LOX_STATS
+            run_stats.enabled = true;
+#else
+            err << "--stats was compiled out of this build (LOX_STATS=OFF)\n";
+            return 1;
+#endif
+        }
 
-    const std::string command = argv[1];
+        std::string file_contents;
+        {
+            LOX_STATS_PHASE(Phase::READ);
+            file_contents = read_file_contents(filename);
+        }
+        LOX_STATS_BYTES(file_contents.size());
+
+        // An unchanged script's bytecode comes straight from its .loxc,
+        // skipping scanning and compiling altogether
+        uint64_t source_hash = 0;
+        std::string cache_path;
+        std::optional<CachedScript> cached;
+        if (cache) {
+            LOX_STATS_PHASE(Phase::CACHE);
+            source_hash = hash_source(file_contents);
+            cache_path = bytecode_cache_path(filename);
+            cached.emplace();
+            if (!cached->load(cache_path, source_hash)) cached.reset();
+        }
 
-    if (command == "tokenize") {
-        std::string file_contents = read_file_contents(argv[2]);
-        
-        if (!file_contents.empty()) {
+        std::vector<Token> tokens;
+        if (!cached) {
+            LOX_STATS_PHASE(Phase::SCAN);
             Scanner scanner(file_contents);
-            std::vector<Token> tokens = scanner.scanTokens();
+            tokens = scanner.scanTokens();
+        }
+        if (stats) {
             for (const auto& token : tokens) {
-                if (magic_enum::enum_name(token.type) == "END_OF_FILE") {
-                    std::cout << "EOF" << " "
-                        << token.lexeme << " "
-                        << ((token.literal == "") ? "null" : token.literal) << '\n';
+                LOX_STATS_COUNT_TOKEN(token.type);
+            }
+        }
+
+        bool ok;
+        if (engine == "vm") {
+            ObjFunction* script;
+            std::span<ObjString* const> global_names;
+            std::optional<Compiler> compiler;
+            if (cached) {
+                script = cached->script();
+                global_names = cached->globalNames();
+            }
+            else {
+                // Compiled straight from the tokens, without building an AST
+                compiler.emplace(std::move(tokens));
+                profile_lines([&] { return compiler->currentLine(); });
+                {
+                    LOX_STATS_PHASE(Phase::PARSE);
+                    script = compiler->compile();
                 }
-                else {
-                    std::cout << magic_enum::enum_name(token.type) << " "
-                        << token.lexeme << " "
-                        << ((token.literal == "") ? "null" : token.literal) << '\n';
+                if (script == nullptr) {
+                    std::exit(65);
                 }
+                global_names = compiler->globalNames();
+                // Saved before running, while the code is as compiled. A
+                // cache that can't be written is only a missed speedup
+                if (cache) {
+                    LOX_STATS_PHASE(Phase::CACHE);
+                    save_bytecode(cache_path, source_hash, script, compiler->globalNames());
+                }
+            }
+            // Done after caching, so a cache doesn't depend on --no-peephole
+            if (peephole) {
+                LOX_STATS_PHASE(Phase::OPTIMIZE);
+                optimize_bytecode(script);
+            }
+            LOX_STATS_PHASE(Phase::EXECUTE);
+            VM vm;
+            profile_lines([&] { return vm.currentLine(); });
+            if (dump_pairs) vm.countOpcodePairs();
+            ok = vm.run(script, global_names);
+            write_heap_profile();
+            if (dump_pairs && !vm.writeOpcodePairs(pairs_path)) {
+                err << "Cannot write opcode pairs to " << pairs_path << '\n';
             }
         }
-        if (had_error) {
-            std::exit(65);
+        else {
+            Ast ast;
+            {
+                LOX_STATS_PHASE(Phase::PARSE);
+                Parser parser(std::move(tokens));
+                ast = parser.parseProgram();
+            }
+            {
+                LOX_STATS_PHASE(Phase::RESOLVE);
+                resolve(ast);
+            }
+            if (had_error) {
+                std::exit(65);
+            }
+            if (fold) {
+                LOX_STATS_PHASE(Phase::OPTIMIZE);
+                // Counting walks the whole tree, so only for the report
+                if (run_stats.enabled) run_stats.ast_nodes = count_nodes(ast, ast.root);
+                run_stats.ast_nodes_removed = fold_constants(ast);
+            }
+            {
+                LOX_STATS_PHASE(Phase::OPTIMIZE);
+                run_stats.frame_allocation_sites = find_frame_allocations(ast);
+            }
+            LOX_STATS_PHASE(Phase::EXECUTE);
+            Interpreter interpreter(ast);
+            profile_lines([&] { return interpreter.currentLine(); });
+            ok = interpreter.run();
+            write_heap_profile();
         }
-        
+
+        if (stats && !report_stats(stats_path)) {
+            err << "Cannot write stats to " << stats_path << '\n';
+        }
+        if (!ok) {
+            std::exit(70);
+        }
+
     } else {
-        std::cerr << "Unknown command: " << command << std::endl;
+        err << "Unknown command: " << command << '\n';
         return 1;
     }
 
     return 0;
 }
-
-std::string read_file_contents(const std::string& filename) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Error reading file: " << filename << std::endl;
-        std::exit(1);
-    }   
-
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    file.close();
-
-    return buffer.str();
-}
-
-void error(int line, const std::string& message) {
-    report(line, "", message);
-}
-
-void report(int line, const std::string& where, const std::string& message) {
-    std::cerr << "[line " << line << "] Error" << where << ": " << message << '\n';
-    had_error = true;
-}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <span>
+
+#include "object.hpp"
+
+// Built-in functions defined as globals before a program starts. Both
+// engines install the same set
+struct NativeDef {
+    const char* name;
+    int arity;
+    NativeFn function;
+};
+
+std::span<const NativeDef> natives();
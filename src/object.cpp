@@ -0,0 +1,175 @@
+#include "object.hpp"
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// FNV-1a: cheap, and good enough for identifier-sized keys
+uint32_t hash_string(std::string_view chars) {
+    uint32_t hash = 2166136261u;
+    for (char c : chars) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+Table::Entry& Table::slotFor(const ObjString* key) {
+    uint32_t mask = static_cast<uint32_t>(entries.size()) - 1;
+    Entry* tombstone = nullptr;
+    for (uint32_t index = key->hash & mask;; index = (index + 1) & mask) {
+        Entry& entry = entries[index];
+        if (entry.key == key) return entry;
+        if (entry.key == nullptr) {
+            // Reuse the first tombstone passed, but only once the key is
+            // known not to be further along the probe sequence
+            if (entry.value.isNil()) return tombstone != nullptr ? *tombstone : entry;
+            if (tombstone == nullptr) tombstone = &entry;
+        }
+    }
+}
+
+bool Table::set(ObjString* key, Value value) {
+    if ((count + 1) * MAX_LOAD_DENOMINATOR > entries.size() * MAX_LOAD_NUMERATOR) {
+        resize(entries.empty() ? 8 : entries.size() * 2);
+    }
+
+    Entry& entry = slotFor(key);
+    bool isNew = entry.key == nullptr;
+    if (isNew) {
+        // Landing on a tombstone doesn't change the load
+        if (entry.value.isNil()) count++;
+        live++;
+    }
+    entry.key = key;
+    entry.value = value;
+    return isNew;
+}
+
+bool Table::remove(const ObjString* key) {
+    if (live == 0) return false;
+    Entry& entry = slotFor(key);
+    if (entry.key == nullptr) return false;
+
+    entry.key = nullptr;
+    entry.value = Value::boolean(true);
+    live--;
+    return true;
+}
+
+void Table::addAll(const Table& from) {
+    from.forEach([this](ObjString* key, Value value) { set(key, value); });
+}
+
+ObjString* Table::findString(std::string_view chars, uint32_t hash) const {
+    if (count == 0) return nullptr;
+    uint32_t mask = static_cast<uint32_t>(entries.size()) - 1;
+    for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+        const Entry& entry = entries[index];
+        if (entry.key == nullptr) {
+            if (entry.value.isNil()) return nullptr;
+        }
+        else if (entry.key->hash == hash && entry.key->view() == chars) {
+            return entry.key;
+        }
+    }
+}
+
+// Rehashing drops the tombstones, so the load goes back to just the live
+// entries
+void Table::resize(size_t capacity) {
+    std::vector<Entry> old = std::exchange(entries, std::vector<Entry>(capacity));
+    count = 0;
+    live = 0;
+    for (const Entry& entry : old) {
+        if (entry.key == nullptr) continue;
+        Entry& slot = slotFor(entry.key);
+        slot = entry;
+        count++;
+        live++;
+    }
+}
+
+uint32_t string_length(const Obj* string) {
+    if (string->type == ObjType::STRING) return static_cast<const ObjString*>(string)->length;
+    return static_cast<const ObjRope*>(string)->length;
+}
+
+// Ropes built in a loop are deep on one side, so the tree is walked with
+// an explicit stack rather than recursion. Pieces already flattened are
+// copied whole
+std::string_view string_chars(Obj* string) {
+    if (string->type == ObjType::STRING) return static_cast<ObjString*>(string)->view();
+    auto* rope = static_cast<ObjRope*>(string);
+    if (rope->flat) return {rope->flat.get(), rope->length};
+
+    rope->flat = std::make_unique_for_overwrite<char[]>(rope->length);
+    char* out = rope->flat.get();
+    std::vector<Obj*> pending{rope->right, rope->left};
+    while (!pending.empty()) {
+        Obj* piece = pending.back();
+        pending.pop_back();
+        if (piece->type == ObjType::ROPE && !static_cast<ObjRope*>(piece)->flat) {
+            pending.push_back(static_cast<ObjRope*>(piece)->right);
+            pending.push_back(static_cast<ObjRope*>(piece)->left);
+            continue;
+        }
+        std::string_view chars = string_chars(piece);
+        std::memcpy(out, chars.data(), chars.size());
+        out += chars.size();
+    }
+    rope->left = nullptr;
+    rope->right = nullptr;
+    return {rope->flat.get(), rope->length};
+}
+
+bool equal_strings(Value a, Value b) {
+    if (!is_string(a) || !is_string(b)) return false;
+    // Two different flat strings can't be equal; they're interned
+    if (a.asObject()->type == ObjType::STRING && b.asObject()->type == ObjType::STRING) return false;
+    if (string_length(a.asObject()) != string_length(b.asObject())) return false;
+    return string_chars(a.asObject()) == string_chars(b.asObject());
+}
+
+namespace {
+
+std::string named_function(const ObjString* name) {
+    if (name == nullptr) return "<script>";
+    return "<fn " + std::string(name->view()) + ">";
+}
+
+std::string function_name(const Obj* function) {
+    switch (function->type) {
+        case ObjType::AST_FUNCTION: return named_function(static_cast<const ObjAstFunction*>(function)->name);
+        case ObjType::FUNCTION: return named_function(static_cast<const ObjFunction*>(function)->name);
+        case ObjType::CLOSURE:
+            return named_function(static_cast<const ObjClosure*>(function)->function->name);
+        default: return "<native fn>";
+    }
+}
+
+}
+
+std::string stringify(Value value) {
+    if (value.isNumber()) return format_number(value.asNumber());
+    if (value.isNil()) return "nil";
+    if (value.isBool()) return value.asBool() ? "true" : "false";
+
+    Obj* object = value.asObject();
+    switch (object->type) {
+        case ObjType::STRING: return std::string(static_cast<ObjString*>(object)->view());
+        case ObjType::ROPE: return std::string(string_chars(object));
+        case ObjType::NATIVE: return "<native fn>";
+        case ObjType::AST_FUNCTION: return function_name(object);
+        case ObjType::CLASS: return std::string(static_cast<ObjClass*>(object)->name->view());
+        case ObjType::INSTANCE:
+            return std::string(static_cast<ObjInstance*>(object)->klass->name->view()) + " instance";
+        case ObjType::SHAPE: return "<shape>";
+        case ObjType::BOUND_METHOD: return function_name(static_cast<ObjBoundMethod*>(object)->method);
+        case ObjType::FUNCTION:
+        case ObjType::CLOSURE: return function_name(object);
+        case ObjType::ENVIRONMENT: return "<environment>";
+        case ObjType::UPVALUE: return "<upvalue>";
+    }
+    return "";
+}
@@ -0,0 +1,433 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ast.hpp"
+#include "chunk.hpp"
+#include "value.hpp"
+
+// Heap-allocated Lox values. Every object starts with an Obj header so a
+// Value can point at any of them and the type tag says which one it is
+
+enum class ObjType : uint8_t {
+    STRING,
+    ROPE,
+    NATIVE,
+    AST_FUNCTION,
+    CLASS,
+    INSTANCE,
+    SHAPE,
+    BOUND_METHOD,
+    ENVIRONMENT,
+    FUNCTION,
+    CLOSURE,
+    UPVALUE,
+};
+
+// Mark bits live in the heap's page bitmaps, not here, so marking never
+// writes to an object's own cache line and the header stays small
+struct Obj {
+    ObjType type;
+    bool large = false;   // too big for a size class; allocated on its own
+    bool inFrame = false; // built in an interpreter block's memory; traced, never freed
+    bool frameMarked = false; // an inFrame object already traced this collection
+
+    explicit Obj(ObjType type) : type(type) {}
+};
+
+// Immutable and interned: two equal strings are always the same object.
+// The characters follow the header in the same allocation, so a string
+// is a single allocation however short it is, and its hash is computed
+// once when it is interned
+struct ObjString : Obj {
+    uint32_t length;
+    uint32_t hash;
+
+    ObjString(uint32_t length, uint32_t hash) : Obj(ObjType::STRING), length(length), hash(hash) {}
+
+    char* chars() { return reinterpret_cast<char*>(this + 1); }
+    const char* chars() const { return reinterpret_cast<const char*>(this + 1); }
+    std::string_view view() const { return {chars(), length}; }
+};
+
+// Open-addressing hash table from interned strings to values, used for
+// shapes, class methods and the string intern set. Keys compare by
+// pointer (equal strings are the same object) and bring their own hash, so
+// a probe never touches the characters. Linear probing over a power-of-two
+// array; removed entries leave a tombstone, which counts towards the load
+// factor until the next resize clears it out
+class Table {
+public:
+    struct Entry {
+        ObjString* key = nullptr;   // nullptr for empty slots and tombstones
+        Value value;                // true marks a tombstone, nil an empty slot
+    };
+
+    // Returns the value stored under `key`, or nullptr if there is none
+    Value* find(const ObjString* key) {
+        if (count == 0) return nullptr;
+        uint32_t mask = static_cast<uint32_t>(entries.size()) - 1;
+        for (uint32_t index = key->hash & mask;; index = (index + 1) & mask) {
+            Entry& entry = entries[index];
+            if (entry.key == key) return &entry.value;
+            if (entry.key == nullptr && entry.value.isNil()) return nullptr;
+        }
+    }
+    const Value* find(const ObjString* key) const { return const_cast<Table*>(this)->find(key); }
+
+    // Returns true if `key` was not in the table before
+    bool set(ObjString* key, Value value);
+    bool remove(const ObjString* key);
+    void addAll(const Table& from);
+
+    // The one lookup that compares characters: finding an existing string
+    // before interning a new one
+    ObjString* findString(std::string_view chars, uint32_t hash) const;
+
+    size_t size() const { return live; }
+
+    template <typename Visit>
+    void forEach(Visit&& visit) const {
+        for (const Entry& entry : entries) {
+            if (entry.key != nullptr) visit(entry.key, entry.value);
+        }
+    }
+
+    // Removes every entry `remove` returns true for. Removing only leaves
+    // tombstones, so nothing moves under the scan
+    template <typename Predicate>
+    void removeIf(Predicate&& remove) {
+        for (Entry& entry : entries) {
+            if (entry.key != nullptr && remove(entry.key)) {
+                entry.key = nullptr;
+                entry.value = Value::boolean(true);
+                live--;
+            }
+        }
+    }
+
+private:
+    // Grow once live entries plus tombstones pass 3/4 of the slots
+    static constexpr uint32_t MAX_LOAD_NUMERATOR = 3;
+    static constexpr uint32_t MAX_LOAD_DENOMINATOR = 4;
+
+    std::vector<Entry> entries;
+    size_t count = 0;   // live entries plus tombstones
+    size_t live = 0;
+
+    Entry& slotFor(const ObjString* key);
+    void resize(size_t capacity);
+};
+
+// The result of a long concatenation, kept as its two halves (each a flat
+// ObjString or another rope) instead of being copied. Building a string
+// with `+` in a loop is then linear rather than quadratic. Ropes are not
+// interned; the characters are only gathered the first time something
+// needs them (printing, or comparing with another string). The rope then
+// keeps them and lets go of its halves, so later reads are as cheap as a
+// flat string's. They go in a buffer of the rope's own rather than a new
+// ObjString so that reading a string never allocates on the collected heap
+struct ObjRope : Obj {
+    uint32_t length;
+    Obj* left;     // both null once flattened
+    Obj* right;
+    std::unique_ptr<char[]> flat;
+
+    ObjRope(uint32_t length, Obj* left, Obj* right) : Obj(ObjType::ROPE), length(length), left(left), right(right) {}
+};
+
+// Length and characters of a string of either kind. Getting a rope's
+// characters flattens it
+uint32_t string_length(const Obj* string);
+std::string_view string_chars(Obj* string);
+
+using NativeFn = Value (*)(int argCount, const Value* args);
+
+struct ObjNative : Obj {
+    NativeFn function;
+    int arity;
+    ObjString* name;
+
+    ObjNative(NativeFn function, int arity, ObjString* name)
+        : Obj(ObjType::NATIVE), function(function), arity(arity), name(name) {}
+};
+
+// One scope's variables for the tree-walking interpreter. Closures keep
+// their defining environment alive, so these live on the heap too. The
+// resolver numbers every local, so a scope is just a fixed array of slots
+// following the header in the same allocation
+struct ObjEnvironment : Obj {
+    ObjEnvironment* enclosing;
+    uint32_t slotCount;
+
+    ObjEnvironment(ObjEnvironment* enclosing, uint32_t slotCount)
+        : Obj(ObjType::ENVIRONMENT), enclosing(enclosing), slotCount(slotCount) {}
+
+    Value* slots() { return reinterpret_cast<Value*>(this + 1); }
+};
+
+// A function declared in the source, run by the tree-walking interpreter
+struct ObjAstFunction : Obj {
+    NodeIndex declaration;  // the FUNCTION node
+    ObjEnvironment* closure;
+    ObjString* name;
+    int arity;
+    bool isInitializer;
+
+    ObjAstFunction(NodeIndex declaration, ObjEnvironment* closure, ObjString* name, int arity, bool isInitializer)
+        : Obj(ObjType::AST_FUNCTION), declaration(declaration), closure(closure), name(name),
+          arity(arity), isInitializer(isInitializer) {}
+};
+
+// A compiled function for the VM: its bytecode plus what a closure needs
+// to know to capture its upvalues. A method or a run-once declaration that
+// captures nothing is a value by itself, with no closure around it. The
+// top-level script is one too, with no name
+struct ObjFunction : Obj {
+    int arity = 0;
+    int upvalueCount = 0;
+    Chunk chunk;
+    ObjString* name = nullptr;
+
+    ObjFunction() : Obj(ObjType::FUNCTION) {}
+};
+
+// A captured variable. While the variable's frame is live `location`
+// points at its stack slot; when the frame exits the value is copied into
+// `closed` and `location` is pointed there, so every closure sharing the
+// upvalue sees the same variable
+struct ObjUpvalue : Obj {
+    Value* location;
+    Value closed;
+    ObjUpvalue* nextOpen = nullptr;  // open upvalues, sorted by stack slot
+
+    explicit ObjUpvalue(Value* slot) : Obj(ObjType::UPVALUE), location(slot) {}
+};
+
+// A function paired with the upvalues it captured. The upvalue pointers
+// follow the header in the same allocation
+struct ObjClosure : Obj {
+    ObjFunction* function;
+
+    explicit ObjClosure(ObjFunction* function) : Obj(ObjType::CLOSURE), function(function) {}
+
+    ObjUpvalue** upvalues() { return reinterpret_cast<ObjUpvalue**>(this + 1); }
+};
+
+struct ObjShape;
+
+struct ObjClass : Obj {
+    ObjString* name;
+    ObjClass* superclass = nullptr;
+    Table methods;
+    ObjShape* rootShape = nullptr;  // shape of a new instance; made by the first one
+    uint32_t instanceSlots = 0;     // most fields an instance has had so far
+
+    explicit ObjClass(ObjString* name) : Obj(ObjType::CLASS), name(name) {}
+};
+
+// The layout shared by instances that were given the same fields in the
+// same order (a "hidden class"). A shape maps each field name to a slot
+// number; adding a field moves an instance on to the child shape for that
+// name, which is created the first time any instance takes that step. So
+// every instance built by the same initializer ends up with the same shape,
+// and each one stores only its values. Every class has its own root shape,
+// so a shape also says which class its instances belong to
+struct ObjShape : Obj {
+    uint32_t slotCount;
+    Table slots;        // field name -> slot number
+    Table transitions;  // field name -> the shape with that field added
+
+    explicit ObjShape(uint32_t slotCount) : Obj(ObjType::SHAPE), slotCount(slotCount) {}
+
+    // Returns the slot holding `name`, or -1 if there is no such field
+    int32_t slotOf(const ObjString* name) const {
+        const Value* slot = slots.find(name);
+        return slot != nullptr ? static_cast<int32_t>(slot->asNumber()) : -1;
+    }
+};
+
+// Field values, in the slots the instance's shape numbers them with. The
+// first `inlineCapacity` slots follow the header in the same allocation,
+// sized by how many fields earlier instances of the class ended up with, so
+// usually that is all there is. Fields added beyond it go in `overflow`,
+// which starts at four slots and doubles as it fills
+struct ObjInstance : Obj {
+    uint32_t inlineCapacity;  // sits in the header's padding
+    ObjClass* klass;
+    ObjShape* shape;
+    std::unique_ptr<Value[]> overflow;
+
+    ObjInstance(ObjClass* klass, ObjShape* shape, uint32_t inlineCapacity)
+        : Obj(ObjType::INSTANCE), inlineCapacity(inlineCapacity), klass(klass), shape(shape) {}
+
+    Value* inlineSlots() { return reinterpret_cast<Value*>(this + 1); }
+    Value& slot(uint32_t index) {
+        return index < inlineCapacity ? inlineSlots()[index] : overflow[index - inlineCapacity];
+    }
+
+    // Returns the field called `name`, or nullptr if there is none
+    Value* field(const ObjString* name) {
+        int32_t index = shape->slotOf(name);
+        return index >= 0 ? &slot(static_cast<uint32_t>(index)) : nullptr;
+    }
+};
+
+// A method looked up on an instance, remembering which instance `this` is
+struct ObjBoundMethod : Obj {
+    Value receiver;
+    Obj* method;
+
+    ObjBoundMethod(Value receiver, Obj* method) : Obj(ObjType::BOUND_METHOD), receiver(receiver), method(method) {}
+};
+
+inline bool is_obj_type(Value value, ObjType type) {
+    return value.isObject() && value.asObject()->type == type;
+}
+
+// Flat strings and ropes are the same type as far as Lox can tell
+inline bool is_string(Value value) {
+    return value.isObject() &&
+           (value.asObject()->type == ObjType::STRING || value.asObject()->type == ObjType::ROPE);
+}
+// Only for values known to be flat, like names in a constant table
+inline ObjString* as_string(Value value) { return static_cast<ObjString*>(value.asObject()); }
+
+class Heap;
+class HeapProfiler;
+
+// Something holding references the collector can't find by tracing from
+// other objects: the VM's stack and globals, the tree-walker's scopes, the
+// compiler's half-built functions. Each registers itself with the heap
+// while it is alive (addRoots/removeRoots) and marks what it holds when a
+// collection starts
+class GcRoots {
+public:
+    virtual void markRoots(Heap& heap) = 0;
+
+protected:
+    ~GcRoots() = default;
+};
+
+// Owns every object the running program creates, and frees the ones it can
+// no longer reach with a mark-sweep collector.
+//
+// Objects up to MAX_SMALL_SIZE bytes are carved out of 64 KiB pages, each
+// page holding cells of one size class, so freed cells are reused exactly
+// and the heap doesn't fragment. A page keeps its mark and "cell in use"
+// bits in bitmaps in its header. Bigger objects get an allocation of their
+// own with the mark bit in front of them.
+//
+// A collection only marks; each page is swept the next time its size
+// class needs a free cell, so the pause is proportional to the live heap
+// rather than the whole heap. The next collection is due once the heap has
+// grown to GROWTH_FACTOR times what survived the last one
+class Heap {
+public:
+    Heap();
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+
+    // Returns the interned string with these characters, creating it if needed
+    ObjString* copyString(std::string_view chars);
+    // Joins two strings of either kind: a new interned string if the result
+    // is short, a rope otherwise
+    Obj* concatenate(Obj* a, Obj* b);
+    ObjClosure* makeClosure(ObjFunction* function);
+    ObjEnvironment* makeEnvironment(ObjEnvironment* enclosing, uint32_t slotCount);
+    ObjInstance* makeInstance(ObjClass* klass);
+    // Builds an instance with room for `fields` fields in `memory`, which
+    // the caller owns (see find_frame_allocations). The collector traces
+    // it like any other object but leaves freeing it to the caller
+    ObjInstance* makeInstanceIn(void* memory, ObjClass* klass, uint32_t fields);
+    static size_t instanceSize(uint32_t fields) { return sizeof(ObjInstance) + fields * sizeof(Value); }
+    // Stores a field, adding it if the instance doesn't have it yet. Adding
+    // one may create the next shape, so it can allocate
+    void setField(ObjInstance* instance, ObjString* name, Value value);
+
+    // Any allocation may collect, so whatever the caller still needs
+    // (including the arguments) must already be reachable from a root
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(sizeof(T) <= MAX_SMALL_SIZE);
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+
+    void addRoots(GcRoots* roots);
+    void removeRoots(GcRoots* roots);
+
+    void markValue(Value value) {
+        if (value.isObject()) markObject(value.asObject());
+    }
+    void markObject(Obj* object);
+
+    void collect();
+    // Collects and sweeps every page straight away, so that everything
+    // unreachable has been freed when it returns
+    void collectAll();
+
+    // Reports allocations and frees to `profiler`, or stops if nullptr
+    void setProfiler(HeapProfiler* profiler) { this->profiler = profiler; }
+
+private:
+    static constexpr size_t PAGE_SIZE = 64 * 1024;
+    static constexpr size_t MAX_SMALL_SIZE = 2048;
+    static constexpr uint32_t MIN_ROPE_LENGTH = 64;
+    static constexpr uint32_t FIRST_INSTANCE_SLOTS = 4;
+    static constexpr uint32_t MAX_INLINE_SLOTS = 64;
+    static constexpr size_t MIN_NEXT_GC = 1024 * 1024;
+    static constexpr size_t GROWTH_FACTOR = 2;
+
+    struct Page;
+    struct LargeObject;
+    struct FreeCell {
+        FreeCell* next;
+    };
+
+    // Swept pages have their free cells on freeList; unswept ones are
+    // waiting for the lazy sweep after a collection
+    struct SizeClass {
+        uint32_t cellSize = 0;
+        FreeCell* freeList = nullptr;
+        Page* pages = nullptr;
+        Page* unswept = nullptr;
+    };
+
+    std::vector<SizeClass> classes;
+    LargeObject* largeObjects = nullptr;
+    std::vector<GcRoots*> roots;
+    std::vector<Obj*> grayStack;
+    // Frame instances traced so far this collection, to clear once it ends
+    std::vector<Obj*> markedFrameObjects;
+    Table strings;  // every interned string, each mapped to nil; weak
+    HeapProfiler* profiler = nullptr;
+
+    size_t bytesAllocated = 0;
+    size_t markedBytes = 0;
+    size_t nextGC = MIN_NEXT_GC;
+
+    void* allocate(size_t size);
+    void* allocateSmall(SizeClass& sizeClass);
+    void* allocateLarge(size_t size);
+    void addPage(SizeClass& sizeClass);
+    void sweepPage(SizeClass& sizeClass, Page* page);
+    void finishSweeping();
+    void sweepLargeObjects();
+    bool isMarked(Obj* object) const;
+    void blacken(Obj* object);
+    ObjString* allocateString(std::string_view chars, uint32_t hash);
+    static void destroy(Obj* object);
+    static Page* pageOf(const Obj* object);
+    static LargeObject* largeHeader(const Obj* object);
+};
+
+extern Heap heap;
+
+uint32_t hash_string(std::string_view chars);
@@ -0,0 +1,248 @@
+#include "optimizer.hpp"
+
+namespace {
+
+class ConstantFolder {
+public:
+    explicit ConstantFolder(Ast& ast) : ast(ast) {}
+
+    void foldStatement(NodeIndex index);
+
+private:
+    Ast& ast;
+
+    void foldExpression(NodeIndex index);
+    uint32_t foldList(uint32_t start, uint32_t count);
+
+    bool isLiteral(NodeIndex index) const;
+    bool isTruthy(NodeIndex index) const;
+    bool literalsEqual(const Node& left, const Node& right) const;
+    bool isNoOp(NodeIndex index) const;
+
+    void setNumber(NodeIndex index, double value);
+    void setBool(NodeIndex index, bool value);
+    void setString(NodeIndex index, std::string value);
+    void makeEmptyBlock(NodeIndex index);
+    void replace(NodeIndex index, NodeIndex with);
+};
+
+void ConstantFolder::foldStatement(NodeIndex index) {
+    Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::PROGRAM:
+        case NodeKind::BLOCK:
+            node.b = foldList(node.a, node.b);
+            break;
+
+        case NodeKind::IF:
+            foldExpression(node.a);
+            foldStatement(node.b);
+            if (node.c != NO_NODE) foldStatement(node.c);
+
+            if (isLiteral(node.a)) {
+                if (isTruthy(node.a)) {
+                    replace(index, node.b);
+                }
+                else if (node.c != NO_NODE) {
+                    replace(index, node.c);
+                }
+                else {
+                    makeEmptyBlock(index);
+                }
+            }
+            break;
+
+        case NodeKind::WHILE:
+            foldExpression(node.a);
+            if (isLiteral(node.a) && !isTruthy(node.a)) {
+                makeEmptyBlock(index);
+            }
+            else {
+                foldStatement(node.b);
+            }
+            break;
+
+        case NodeKind::FUNCTION:
+            foldStatement(node.c);
+            break;
+
+        case NodeKind::CLASS:
+            for (NodeIndex method : ast.list(node.b, node.c)) foldStatement(method);
+            break;
+
+        default:
+            for_each_child(ast, node, [&](NodeIndex child) { foldExpression(child); });
+            break;
+    }
+}
+
+// Folds each statement of a list, then compacts the run in place: no-ops
+// are dropped and nothing after a `return` can run. Returns the new length
+uint32_t ConstantFolder::foldList(uint32_t start, uint32_t count) {
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        NodeIndex statement = ast.lists[start + i];
+        foldStatement(statement);
+        if (isNoOp(statement)) continue;
+
+        ast.lists[start + kept++] = statement;
+        if (ast[statement].kind == NodeKind::RETURN) break;
+    }
+    return kept;
+}
+
+void ConstantFolder::foldExpression(NodeIndex index) {
+    Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::GROUPING:
+            foldExpression(node.a);
+            replace(index, node.a);
+            break;
+
+        case NodeKind::UNARY:
+            foldExpression(node.a);
+            if (node.op == TokenType::BANG && isLiteral(node.a)) {
+                setBool(index, !isTruthy(node.a));
+            }
+            else if (node.op == TokenType::MINUS && ast[node.a].kind == NodeKind::NUMBER) {
+                setNumber(index, -Ast::number(ast[node.a]));
+            }
+            break;
+
+        case NodeKind::BINARY: {
+            foldExpression(node.a);
+            foldExpression(node.b);
+            const Node& left = ast[node.a];
+            const Node& right = ast[node.b];
+
+            if (node.op == TokenType::EQUAL_EQUAL || node.op == TokenType::BANG_EQUAL) {
+                if (isLiteral(node.a) && isLiteral(node.b)) {
+                    bool equal = literalsEqual(left, right);
+                    setBool(index, node.op == TokenType::EQUAL_EQUAL ? equal : !equal);
+                }
+                break;
+            }
+
+            if (left.kind == NodeKind::STRING && right.kind == NodeKind::STRING) {
+                if (node.op == TokenType::PLUS) {
+                    setString(index, ast.token(left).literal + ast.token(right).literal);
+                }
+                break;
+            }
+
+            if (left.kind != NodeKind::NUMBER || right.kind != NodeKind::NUMBER) break;
+            double a = Ast::number(left);
+            double b = Ast::number(right);
+            switch (node.op) {
+                case TokenType::PLUS: setNumber(index, a + b); break;
+                case TokenType::MINUS: setNumber(index, a - b); break;
+                case TokenType::STAR: setNumber(index, a * b); break;
+                case TokenType::SLASH: setNumber(index, a / b); break;
+                case TokenType::GREATER: setBool(index, a > b); break;
+                case TokenType::GREATER_EQUAL: setBool(index, a >= b); break;
+                case TokenType::LESS: setBool(index, a < b); break;
+                case TokenType::LESS_EQUAL: setBool(index, a <= b); break;
+                default: break;
+            }
+            break;
+        }
+
+        case NodeKind::LOGICAL:
+            foldExpression(node.a);
+            foldExpression(node.b);
+            if (isLiteral(node.a)) {
+                // `and` keeps a falsey left operand, `or` a truthy one
+                bool keepLeft = isTruthy(node.a) == (node.op == TokenType::OR);
+                replace(index, keepLeft ? node.a : node.b);
+            }
+            break;
+
+        default:
+            for_each_child(ast, node, [&](NodeIndex child) { foldExpression(child); });
+            break;
+    }
+}
+
+bool ConstantFolder::isLiteral(NodeIndex index) const {
+    switch (ast[index].kind) {
+        case NodeKind::NUMBER:
+        case NodeKind::STRING:
+        case NodeKind::TRUE:
+        case NodeKind::FALSE:
+        case NodeKind::NIL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Only meaningful for literals: nil and false are falsey
+bool ConstantFolder::isTruthy(NodeIndex index) const {
+    NodeKind kind = ast[index].kind;
+    return kind != NodeKind::NIL && kind != NodeKind::FALSE;
+}
+
+bool ConstantFolder::literalsEqual(const Node& left, const Node& right) const {
+    if (left.kind != right.kind) return false;
+    switch (left.kind) {
+        case NodeKind::NUMBER: return Ast::number(left) == Ast::number(right);
+        case NodeKind::STRING: return ast.token(left).literal == ast.token(right).literal;
+        default: return true;
+    }
+}
+
+bool ConstantFolder::isNoOp(NodeIndex index) const {
+    const Node& node = ast[index];
+    if (node.kind == NodeKind::BLOCK) return node.b == 0;
+    if (node.kind == NodeKind::EXPRESSION) return isLiteral(node.a);
+    return false;
+}
+
+// Moves a node up into its parent's place, along with how its names were
+// resolved if the resolver has already run
+void ConstantFolder::replace(NodeIndex index, NodeIndex with) {
+    ast[index] = ast[with];
+    if (!ast.bindings.empty()) ast.bindings[index] = ast.bindings[with];
+}
+
+// The folded node keeps its own token, so its line is still the operator's
+
+void ConstantFolder::setNumber(NodeIndex index, double value) {
+    Node& node = ast[index];
+    node = Node{NodeKind::NUMBER, TokenType::END_OF_FILE, node.token};
+    Ast::setNumber(node, value);
+}
+
+void ConstantFolder::setBool(NodeIndex index, bool value) {
+    Node& node = ast[index];
+    node = Node{value ? NodeKind::TRUE : NodeKind::FALSE, TokenType::END_OF_FILE, node.token};
+}
+
+// String values live in their token's literal, so a folded concatenation
+// gets a synthetic STRING token of its own
+void ConstantFolder::setString(NodeIndex index, std::string value) {
+    Node& node = ast[index];
+    int line = ast.line(node);
+    ast.tokens.emplace_back(TokenType::STRING, "\"" + value + "\"", value, line);
+    node = Node{NodeKind::STRING, TokenType::END_OF_FILE, static_cast<uint32_t>(ast.tokens.size() - 1)};
+}
+
+void ConstantFolder::makeEmptyBlock(NodeIndex index) {
+    Node& node = ast[index];
+    node = Node{NodeKind::BLOCK, TokenType::END_OF_FILE, node.token, 0, 0};
+    if (!ast.bindings.empty()) ast.bindings[index] = Binding{};
+}
+
+}
+
+size_t count_nodes(const Ast& ast, NodeIndex root) {
+    size_t count = 1;
+    for_each_child(ast, ast[root], [&](NodeIndex child) { count += count_nodes(ast, child); });
+    return count;
+}
+
+size_t fold_constants(Ast& ast) {
+    size_t before = count_nodes(ast, ast.root);
+    ConstantFolder(ast).foldStatement(ast.root);
+    return before - count_nodes(ast, ast.root);
+}
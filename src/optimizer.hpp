@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+#include "ast.hpp"
+
+// Compile-time clean-up of a parsed program, run before the tree-walker
+// sees it:
+//   - constant expressions are folded: 2 * 3 becomes 6, "a" + "b" becomes
+//     "ab", !nil becomes true, 1 == 1 becomes true, and `and`/`or` with a
+//     literal left operand pick their result
+//   - `if` and `while` with a literal condition lose their dead branch or
+//     body, and blocks drop the statements after a `return` and statements
+//     that do nothing (empty blocks, a bare literal)
+// Anything that could fail at runtime, such as "a" + 1, is left alone so the
+// error still happens when and where it would have.
+//
+// Rewrites happen in place, so node indices held by parents stay valid, and
+// bindings from resolve() are carried along with the nodes they belong to.
+// Returns how many nodes are no longer reachable from the root
+size_t fold_constants(Ast& ast);
+
+// Number of nodes reachable from `root`
+size_t count_nodes(const Ast& ast, NodeIndex root);
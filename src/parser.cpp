@@ -0,0 +1,478 @@
+#include "parser.hpp"
+
+#include <charconv>
+
+#include "error.hpp"
+
+Parser::Parser(std::vector<Token> tokens) {
+    // Nearly every node consumes at least one token of its own (the few
+    // synthetic nodes of a desugared `for` are paid for by its punctuation),
+    // so in practice parsing never has to grow the arena
+    ast.nodes.reserve(tokens.size() + 1);
+    ast.tokens = std::move(tokens);
+}
+
+Ast Parser::parseExpression() {
+    try {
+        ast.root = expression();
+    }
+    catch (const ParseError&) {
+        ast.root = NO_NODE;
+    }
+    return std::move(ast);
+}
+
+Ast Parser::parseProgram() {
+    size_t mark = scratch.size();
+    while (!isAtEnd()) {
+        NodeIndex statement = declaration();
+        if (statement != NO_NODE) scratch.push_back(statement);
+    }
+    uint32_t count = static_cast<uint32_t>(scratch.size() - mark);
+    uint32_t start = commitList(mark);
+    ast.root = addNode(NodeKind::PROGRAM, current, start, count);
+    return std::move(ast);
+}
+
+// Statement-level error recovery happens here: a syntax error anywhere in
+// the declaration abandons it, drops any half-built child lists and skips
+// ahead to something that looks like the next statement
+NodeIndex Parser::declaration() {
+    size_t mark = scratch.size();
+    try {
+        if (match(TokenType::CLASS)) return classDeclaration();
+        if (match(TokenType::FUN)) return function("function");
+        if (match(TokenType::VAR)) return varDeclaration();
+        return statement();
+    }
+    catch (const ParseError&) {
+        scratch.resize(mark);
+        synchronize();
+        return NO_NODE;
+    }
+}
+
+NodeIndex Parser::classDeclaration() {
+    uint32_t name = consume(TokenType::IDENTIFIER, "Expect class name.");
+
+    NodeIndex superclass = NO_NODE;
+    if (match(TokenType::LESS)) {
+        uint32_t superName = consume(TokenType::IDENTIFIER, "Expect superclass name.");
+        superclass = addNode(NodeKind::VARIABLE, superName);
+    }
+
+    consume(TokenType::LEFT_BRACE, "Expect '{' before class body.");
+    size_t mark = scratch.size();
+    while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        scratch.push_back(function("method"));
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after class body.");
+
+    uint32_t count = static_cast<uint32_t>(scratch.size() - mark);
+    uint32_t start = commitList(mark);
+    return addNode(NodeKind::CLASS, name, superclass, start, count);
+}
+
+NodeIndex Parser::function(const std::string& kind) {
+    uint32_t name = consume(TokenType::IDENTIFIER, "Expect " + kind + " name.");
+    consume(TokenType::LEFT_PAREN, "Expect '(' after " + kind + " name.");
+
+    size_t mark = scratch.size();
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            if (scratch.size() - mark >= 255) {
+                error(peek(), "Can't have more than 255 parameters.");
+            }
+            scratch.push_back(consume(TokenType::IDENTIFIER, "Expect parameter name."));
+        } while (match(TokenType::COMMA));
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after parameters.");
+    uint32_t count = static_cast<uint32_t>(scratch.size() - mark);
+    uint32_t start = commitList(mark);
+
+    consume(TokenType::LEFT_BRACE, "Expect '{' before " + kind + " body.");
+    NodeIndex body = block();
+    return addNode(NodeKind::FUNCTION, name, start, count, body);
+}
+
+NodeIndex Parser::varDeclaration() {
+    uint32_t name = consume(TokenType::IDENTIFIER, "Expect variable name.");
+
+    NodeIndex initializer = NO_NODE;
+    if (match(TokenType::EQUAL)) {
+        initializer = expression();
+    }
+
+    consume(TokenType::SEMICOLON, "Expect ';' after variable declaration.");
+    return addNode(NodeKind::VAR, name, initializer);
+}
+
+NodeIndex Parser::statement() {
+    if (match(TokenType::FOR)) return forStatement();
+    if (match(TokenType::IF)) return ifStatement();
+    if (match(TokenType::PRINT)) return printStatement();
+    if (match(TokenType::RETURN)) return returnStatement();
+    if (match(TokenType::WHILE)) return whileStatement();
+    if (match(TokenType::LEFT_BRACE)) return block();
+    return expressionStatement();
+}
+
+// There is no FOR node: the loop is desugared on the spot into
+// { initializer; while (condition) { body; increment; } }
+NodeIndex Parser::forStatement() {
+    uint32_t keyword = current - 1;
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'for'.");
+
+    NodeIndex initializer = NO_NODE;
+    if (match(TokenType::SEMICOLON)) {
+        // No initializer
+    }
+    else if (match(TokenType::VAR)) {
+        initializer = varDeclaration();
+    }
+    else {
+        initializer = expressionStatement();
+    }
+
+    NodeIndex condition = NO_NODE;
+    if (!check(TokenType::SEMICOLON)) {
+        condition = expression();
+    }
+    consume(TokenType::SEMICOLON, "Expect ';' after loop condition.");
+
+    NodeIndex increment = NO_NODE;
+    if (!check(TokenType::RIGHT_PAREN)) {
+        increment = expression();
+    }
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    NodeIndex body = statement();
+
+    if (increment != NO_NODE) {
+        NodeIndex incrementStatement = addNode(NodeKind::EXPRESSION, ast[increment].token, increment);
+        uint32_t start = static_cast<uint32_t>(ast.lists.size());
+        ast.lists.push_back(body);
+        ast.lists.push_back(incrementStatement);
+        body = addNode(NodeKind::BLOCK, keyword, start, 2);
+    }
+
+    if (condition == NO_NODE) {
+        condition = addNode(NodeKind::TRUE, keyword);
+    }
+    body = addNode(NodeKind::WHILE, keyword, condition, body);
+
+    if (initializer != NO_NODE) {
+        uint32_t start = static_cast<uint32_t>(ast.lists.size());
+        ast.lists.push_back(initializer);
+        ast.lists.push_back(body);
+        body = addNode(NodeKind::BLOCK, keyword, start, 2);
+    }
+    return body;
+}
+
+NodeIndex Parser::ifStatement() {
+    uint32_t keyword = current - 1;
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'if'.");
+    NodeIndex condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after if condition.");
+
+    NodeIndex thenBranch = statement();
+    NodeIndex elseBranch = NO_NODE;
+    if (match(TokenType::ELSE)) {
+        elseBranch = statement();
+    }
+    return addNode(NodeKind::IF, keyword, condition, thenBranch, elseBranch);
+}
+
+NodeIndex Parser::printStatement() {
+    uint32_t keyword = current - 1;
+    NodeIndex value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after value.");
+    return addNode(NodeKind::PRINT, keyword, value);
+}
+
+NodeIndex Parser::returnStatement() {
+    uint32_t keyword = current - 1;
+    NodeIndex value = NO_NODE;
+    if (!check(TokenType::SEMICOLON)) {
+        value = expression();
+    }
+    consume(TokenType::SEMICOLON, "Expect ';' after return value.");
+    return addNode(NodeKind::RETURN, keyword, value);
+}
+
+NodeIndex Parser::whileStatement() {
+    uint32_t keyword = current - 1;
+    consume(TokenType::LEFT_PAREN, "Expect '(' after 'while'.");
+    NodeIndex condition = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after condition.");
+    NodeIndex body = statement();
+    return addNode(NodeKind::WHILE, keyword, condition, body);
+}
+
+NodeIndex Parser::expressionStatement() {
+    NodeIndex value = expression();
+    consume(TokenType::SEMICOLON, "Expect ';' after expression.");
+    return addNode(NodeKind::EXPRESSION, ast[value].token, value);
+}
+
+// Expects the '{' to have been consumed already
+NodeIndex Parser::block() {
+    uint32_t brace = current - 1;
+    size_t mark = scratch.size();
+    while (!check(TokenType::RIGHT_BRACE) && !isAtEnd()) {
+        NodeIndex statement = declaration();
+        if (statement != NO_NODE) scratch.push_back(statement);
+    }
+    consume(TokenType::RIGHT_BRACE, "Expect '}' after block.");
+
+    uint32_t count = static_cast<uint32_t>(scratch.size() - mark);
+    uint32_t start = commitList(mark);
+    return addNode(NodeKind::BLOCK, brace, start, count);
+}
+
+// Skips tokens until the start of what is probably the next statement
+void Parser::synchronize() {
+    advance();
+    while (!isAtEnd()) {
+        if (previous().type == TokenType::SEMICOLON) return;
+
+        switch (peek().type) {
+            case TokenType::CLASS:
+            case TokenType::FUN:
+            case TokenType::VAR:
+            case TokenType::FOR:
+            case TokenType::IF:
+            case TokenType::WHILE:
+            case TokenType::PRINT:
+            case TokenType::RETURN:
+                return;
+            default:
+                break;
+        }
+        advance();
+    }
+}
+
+uint32_t Parser::commitList(size_t mark) {
+    uint32_t start = static_cast<uint32_t>(ast.lists.size());
+    ast.lists.insert(ast.lists.end(), scratch.begin() + mark, scratch.end());
+    scratch.resize(mark);
+    return start;
+}
+
+// The Pratt table: what a token means at the start of an expression, what
+// it means after one, and how tightly it binds in the latter case
+const Parser::ParseRule& Parser::getRule(TokenType type) {
+    static const ParseRule none            {nullptr,                   nullptr,          Precedence::NONE};
+    static const ParseRule leftParen       {&Parser::grouping,         &Parser::call,    Precedence::CALL};
+    static const ParseRule dot             {nullptr,                   &Parser::dot,     Precedence::CALL};
+    static const ParseRule minus           {&Parser::unary,            &Parser::binary,  Precedence::TERM};
+    static const ParseRule plus            {nullptr,                   &Parser::binary,  Precedence::TERM};
+    static const ParseRule factor          {nullptr,                   &Parser::binary,  Precedence::FACTOR};
+    static const ParseRule bang            {&Parser::unary,            nullptr,          Precedence::NONE};
+    static const ParseRule equality        {nullptr,                   &Parser::binary,  Precedence::EQUALITY};
+    static const ParseRule comparison      {nullptr,                   &Parser::binary,  Precedence::COMPARISON};
+    static const ParseRule identifier      {&Parser::variable,         nullptr,          Precedence::NONE};
+    static const ParseRule stringLiteral   {&Parser::string,           nullptr,          Precedence::NONE};
+    static const ParseRule numberLiteral   {&Parser::number,           nullptr,          Precedence::NONE};
+    static const ParseRule keywordLiteral  {&Parser::literal,          nullptr,          Precedence::NONE};
+    static const ParseRule andRule         {nullptr,                   &Parser::logical, Precedence::AND};
+    static const ParseRule orRule          {nullptr,                   &Parser::logical, Precedence::OR};
+    static const ParseRule thisRule        {&Parser::thisExpression,   nullptr,          Precedence::NONE};
+    static const ParseRule superRule       {&Parser::superExpression,  nullptr,          Precedence::NONE};
+
+    switch (type) {
+        case TokenType::LEFT_PAREN: return leftParen;
+        case TokenType::DOT: return dot;
+        case TokenType::MINUS: return minus;
+        case TokenType::PLUS: return plus;
+        case TokenType::SLASH:
+        case TokenType::STAR: return factor;
+        case TokenType::BANG: return bang;
+        case TokenType::BANG_EQUAL:
+        case TokenType::EQUAL_EQUAL: return equality;
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL: return comparison;
+        case TokenType::IDENTIFIER: return identifier;
+        case TokenType::STRING: return stringLiteral;
+        case TokenType::NUMBER: return numberLiteral;
+        case TokenType::TRUE:
+        case TokenType::FALSE:
+        case TokenType::NIL: return keywordLiteral;
+        case TokenType::AND: return andRule;
+        case TokenType::OR: return orRule;
+        case TokenType::THIS: return thisRule;
+        case TokenType::SUPER: return superRule;
+        default: return none;
+    }
+}
+
+NodeIndex Parser::expression() {
+    return parsePrecedence(Precedence::ASSIGNMENT);
+}
+
+// Parses anything that binds at least as tightly as `precedence`: one
+// prefix expression, then as many infix operators as are strong enough
+NodeIndex Parser::parsePrecedence(Precedence precedence) {
+    PrefixFn prefix = getRule(peek().type).prefix;
+    if (prefix == nullptr) {
+        throw error(peek(), "Expect expression.");
+    }
+    advance();
+
+    // Only the loosest level may consume an `=`, so a + b = c is rejected
+    bool canAssign = precedence <= Precedence::ASSIGNMENT;
+    NodeIndex left = (this->*prefix)(canAssign);
+
+    while (precedence <= getRule(peek().type).precedence) {
+        advance();
+        left = (this->*getRule(previous().type).infix)(left, canAssign);
+    }
+
+    if (canAssign && match(TokenType::EQUAL)) {
+        throw error(previous(), "Invalid assignment target.");
+    }
+    return left;
+}
+
+NodeIndex Parser::number(bool) {
+    const Token& token = previous();
+    double value = 0;
+    std::from_chars(token.lexeme.data(), token.lexeme.data() + token.lexeme.size(), value);
+
+    Node node{NodeKind::NUMBER};
+    node.token = current - 1;
+    Ast::setNumber(node, value);
+    return ast.add(node);
+}
+
+NodeIndex Parser::string(bool) {
+    return addNode(NodeKind::STRING, current - 1);
+}
+
+NodeIndex Parser::literal(bool) {
+    switch (previous().type) {
+        case TokenType::TRUE: return addNode(NodeKind::TRUE, current - 1);
+        case TokenType::FALSE: return addNode(NodeKind::FALSE, current - 1);
+        default: return addNode(NodeKind::NIL, current - 1);
+    }
+}
+
+NodeIndex Parser::grouping(bool) {
+    uint32_t paren = current - 1;
+    NodeIndex inner = expression();
+    consume(TokenType::RIGHT_PAREN, "Expect ')' after expression.");
+    return addNode(NodeKind::GROUPING, paren, inner);
+}
+
+NodeIndex Parser::unary(bool) {
+    uint32_t op = current - 1;
+    NodeIndex operand = parsePrecedence(Precedence::UNARY);
+    return addNode(NodeKind::UNARY, op, operand, NO_NODE, NO_NODE, ast.tokens[op].type);
+}
+
+NodeIndex Parser::variable(bool canAssign) {
+    uint32_t name = current - 1;
+    if (canAssign && match(TokenType::EQUAL)) {
+        NodeIndex value = expression();
+        return addNode(NodeKind::ASSIGN, name, value);
+    }
+    return addNode(NodeKind::VARIABLE, name);
+}
+
+NodeIndex Parser::thisExpression(bool) {
+    return addNode(NodeKind::THIS, current - 1);
+}
+
+NodeIndex Parser::superExpression(bool) {
+    uint32_t keyword = current - 1;
+    consume(TokenType::DOT, "Expect '.' after 'super'.");
+    uint32_t method = consume(TokenType::IDENTIFIER, "Expect superclass method name.");
+    return addNode(NodeKind::SUPER, method, keyword);
+}
+
+// Left-associative: the right operand may only contain tighter operators
+NodeIndex Parser::binary(NodeIndex left, bool) {
+    uint32_t op = current - 1;
+    TokenType type = ast.tokens[op].type;
+    const ParseRule& rule = getRule(type);
+    NodeIndex right = parsePrecedence(static_cast<Precedence>(static_cast<uint8_t>(rule.precedence) + 1));
+    return addNode(NodeKind::BINARY, op, left, right, NO_NODE, type);
+}
+
+NodeIndex Parser::logical(NodeIndex left, bool) {
+    uint32_t op = current - 1;
+    TokenType type = ast.tokens[op].type;
+    Precedence precedence = type == TokenType::AND ? Precedence::AND : Precedence::OR;
+    NodeIndex right = parsePrecedence(static_cast<Precedence>(static_cast<uint8_t>(precedence) + 1));
+    return addNode(NodeKind::LOGICAL, op, left, right, NO_NODE, type);
+}
+
+NodeIndex Parser::call(NodeIndex callee, bool) {
+    // Arguments may contain calls of their own, so they collect on the
+    // scratch stack and are copied into `lists` as one run at the end
+    size_t mark = scratch.size();
+    if (!check(TokenType::RIGHT_PAREN)) {
+        do {
+            if (scratch.size() - mark >= 255) {
+                error(peek(), "Can't have more than 255 arguments.");
+            }
+            scratch.push_back(expression());
+        } while (match(TokenType::COMMA));
+    }
+    uint32_t paren = consume(TokenType::RIGHT_PAREN, "Expect ')' after arguments.");
+
+    uint32_t count = static_cast<uint32_t>(scratch.size() - mark);
+    uint32_t start = commitList(mark);
+    return addNode(NodeKind::CALL, paren, callee, start, count);
+}
+
+NodeIndex Parser::dot(NodeIndex object, bool canAssign) {
+    uint32_t name = consume(TokenType::IDENTIFIER, "Expect property name after '.'.");
+    if (canAssign && match(TokenType::EQUAL)) {
+        NodeIndex value = expression();
+        return addNode(NodeKind::SET, name, object, value);
+    }
+    return addNode(NodeKind::GET, name, object);
+}
+
+NodeIndex Parser::addNode(NodeKind kind, uint32_t token, NodeIndex a, NodeIndex b, NodeIndex c, TokenType op) {
+    Node node{kind};
+    node.op = op;
+    node.token = token;
+    node.a = a;
+    node.b = b;
+    node.c = c;
+    return ast.add(node);
+}
+
+uint32_t Parser::advance() {
+    if (!isAtEnd()) current++;
+    return current - 1;
+}
+
+bool Parser::match(TokenType type) {
+    if (!check(type)) return false;
+    advance();
+    return true;
+}
+
+uint32_t Parser::consume(TokenType type, const std::string& message) {
+    if (check(type)) return advance();
+    throw error(peek(), message);
+}
+
+// Reports the error but leaves it to the caller whether to unwind, so a
+// recoverable problem (too many arguments) doesn't abandon the parse
+ParseError Parser::error(const Token& token, const std::string& message) {
+    if (token.type == TokenType::END_OF_FILE) {
+        report(token.line, " at end", message);
+    }
+    else {
+        report(token.line, " at '" + token.lexeme + "'", message);
+    }
+    return ParseError();
+}
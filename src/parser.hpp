@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstdint>
+#include <exception>
+#include <string>
+#include <vector>
+
+#include "ast.hpp"
+#include "token.hpp"
+
+// Binding power of each infix operator, loosest first
+enum class Precedence : uint8_t {
+    NONE,
+    ASSIGNMENT,  // =
+    OR,          // or
+    AND,         // and
+    EQUALITY,    // == !=
+    COMPARISON,  // < > <= >=
+    TERM,        // + -
+    FACTOR,      // * /
+    UNARY,       // ! -
+    CALL,        // . ()
+    PRIMARY
+};
+
+// Thrown to unwind out of a construct after a syntax error has been reported
+struct ParseError : std::exception {};
+
+// Pratt (top-down operator precedence) parser producing a flat Ast
+class Parser {
+public:
+    explicit Parser(std::vector<Token> tokens);
+
+    // Parses the whole input as a single expression, as the `parse`
+    // command wants. Errors are reported and leave ast.root as NO_NODE
+    Ast parseExpression();
+
+    // Parses a whole program into a PROGRAM root. After a syntax error the
+    // parser skips to the next statement and carries on, so one run reports
+    // as many errors as it can
+    Ast parseProgram();
+
+private:
+    using PrefixFn = NodeIndex (Parser::*)(bool canAssign);
+    using InfixFn = NodeIndex (Parser::*)(NodeIndex left, bool canAssign);
+
+    struct ParseRule {
+        PrefixFn prefix;
+        InfixFn infix;
+        Precedence precedence;
+    };
+
+    Ast ast;
+    uint32_t current = 0;
+    // Children of the lists being parsed, innermost last. A finished list is
+    // copied into ast.lists in one go, so nesting needs no temporary vectors
+    std::vector<NodeIndex> scratch;
+
+    static const ParseRule& getRule(TokenType type);
+
+    // Statements
+    NodeIndex declaration();
+    NodeIndex classDeclaration();
+    NodeIndex function(const std::string& kind);
+    NodeIndex varDeclaration();
+    NodeIndex statement();
+    NodeIndex forStatement();
+    NodeIndex ifStatement();
+    NodeIndex printStatement();
+    NodeIndex returnStatement();
+    NodeIndex whileStatement();
+    NodeIndex expressionStatement();
+    NodeIndex block();
+    void synchronize();
+
+    // Moves scratch[mark..] into ast.lists and returns where the run starts
+    uint32_t commitList(size_t mark);
+
+    NodeIndex expression();
+    NodeIndex parsePrecedence(Precedence precedence);
+
+    // Prefix parselets
+    NodeIndex number(bool canAssign);
+    NodeIndex string(bool canAssign);
+    NodeIndex literal(bool canAssign);
+    NodeIndex grouping(bool canAssign);
+    NodeIndex unary(bool canAssign);
+    NodeIndex variable(bool canAssign);
+    NodeIndex thisExpression(bool canAssign);
+    NodeIndex superExpression(bool canAssign);
+
+    // Infix parselets
+    NodeIndex binary(NodeIndex left, bool canAssign);
+    NodeIndex logical(NodeIndex left, bool canAssign);
+    NodeIndex call(NodeIndex left, bool canAssign);
+    NodeIndex dot(NodeIndex left, bool canAssign);
+
+    NodeIndex addNode(NodeKind kind, uint32_t token, NodeIndex a = NO_NODE, NodeIndex b = NO_NODE,
+                      NodeIndex c = NO_NODE, TokenType op = TokenType::END_OF_FILE);
+
+    const Token& peek() const { return ast.tokens[current]; }
+    const Token& previous() const { return ast.tokens[current - 1]; }
+    bool isAtEnd() const { return peek().type == TokenType::END_OF_FILE; }
+    bool check(TokenType type) const { return peek().type == type; }
+    uint32_t advance();
+    bool match(TokenType type);
+    uint32_t consume(TokenType type, const std::string& message);
+
+    ParseError error(const Token& token, const std::string& message);
+};
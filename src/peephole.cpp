@@ -0,0 +1,312 @@
+#include "peephole.hpp"
+
+#include <cstdint>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
+#include "chunk.hpp"
+
+namespace {
+
+constexpr uint32_t NOT_AN_INSTRUCTION = std::numeric_limits<uint32_t>::max();
+
+uint16_t read_short(const std::vector<uint8_t>& code, size_t at) {
+    return static_cast<uint16_t>((code[at] << 8) | code[at + 1]);
+}
+
+// Bytes an instruction takes, operands included
+size_t instruction_length(const Chunk& chunk, size_t offset) {
+    switch (static_cast<OpCode>(chunk.code[offset])) {
+        case OpCode::NIL:
+        case OpCode::TRUE:
+        case OpCode::FALSE:
+        case OpCode::POP:
+        case OpCode::EQUAL:
+        case OpCode::NOT_EQUAL:
+        case OpCode::GREATER:
+        case OpCode::GREATER_EQUAL:
+        case OpCode::LESS:
+        case OpCode::LESS_EQUAL:
+        case OpCode::ADD:
+        case OpCode::SUBTRACT:
+        case OpCode::MULTIPLY:
+        case OpCode::DIVIDE:
+        case OpCode::NOT:
+        case OpCode::NEGATE:
+        case OpCode::PRINT:
+        case OpCode::CLOSE_UPVALUE:
+        case OpCode::RETURN:
+        case OpCode::INHERIT:
+        case OpCode::ADD_NUM:
+        case OpCode::ADD_STR:
+        case OpCode::ADD_ANY:
+            return 1;
+
+        case OpCode::GET_LOCAL:
+        case OpCode::SET_LOCAL:
+        case OpCode::GET_UPVALUE:
+        case OpCode::SET_UPVALUE:
+        case OpCode::CALL:
+        case OpCode::SET_LOCAL_POP:
+            return 2;
+
+        case OpCode::CONSTANT:
+        case OpCode::GET_GLOBAL:
+        case OpCode::DEFINE_GLOBAL:
+        case OpCode::SET_GLOBAL:
+        case OpCode::GET_SUPER:
+        case OpCode::JUMP:
+        case OpCode::JUMP_IF_FALSE:
+        case OpCode::LOOP:
+        case OpCode::CLASS:
+        case OpCode::METHOD:
+        case OpCode::GET_LOCAL_2:
+        case OpCode::POP_JUMP_IF_FALSE:
+        case OpCode::LESS_JUMP_IF_FALSE:
+        case OpCode::LESS_EQUAL_JUMP_IF_FALSE:
+        case OpCode::GREATER_JUMP_IF_FALSE:
+        case OpCode::GREATER_EQUAL_JUMP_IF_FALSE:
+            return 3;
+
+        case OpCode::SUPER_INVOKE:
+        case OpCode::GET_LOCAL_CONSTANT:
+        case OpCode::ADD_CONSTANT_TO_LOCAL:
+            return 4;
+
+        case OpCode::GET_PROPERTY:
+        case OpCode::SET_PROPERTY:
+        case OpCode::SET_PROPERTY_POP:
+            return 5;
+
+        case OpCode::INVOKE:
+            return 6;
+
+        case OpCode::CLOSURE: {
+            auto* function = static_cast<ObjFunction*>(chunk.constants[read_short(chunk.code, offset + 1)].asObject());
+            return 3 + 2 * static_cast<size_t>(function->upvalueCount);
+        }
+    }
+    return 1;
+}
+
+OpCode compare_and_jump(OpCode compare) {
+    switch (compare) {
+        case OpCode::LESS: return OpCode::LESS_JUMP_IF_FALSE;
+        case OpCode::LESS_EQUAL: return OpCode::LESS_EQUAL_JUMP_IF_FALSE;
+        case OpCode::GREATER: return OpCode::GREATER_JUMP_IF_FALSE;
+        default: return OpCode::GREATER_EQUAL_JUMP_IF_FALSE;
+    }
+}
+
+bool is_jump(OpCode op) {
+    return op == OpCode::JUMP || op == OpCode::JUMP_IF_FALSE || op == OpCode::LOOP;
+}
+
+class Peephole {
+public:
+    explicit Peephole(Chunk& chunk) : chunk(chunk) {}
+
+    void run();
+
+private:
+    struct Jump {
+        size_t operand;     // where its offset goes in the new code
+        size_t oldTarget;
+        bool backward;
+    };
+
+    Chunk& chunk;
+    std::vector<size_t> starts;        // offset of every instruction, in order
+    std::vector<bool> targets;         // by old offset: some jump lands here
+    std::vector<uint32_t> newOffsets;  // by old offset, for the instructions kept
+    std::vector<uint8_t> code;
+    std::vector<int> lines;
+    std::vector<Jump> jumps;
+
+    size_t fuse(size_t index);
+    void copy(size_t index);
+
+    OpCode op(size_t index) const { return static_cast<OpCode>(chunk.code[starts[index]]); }
+    uint8_t operand(size_t index, size_t byte) const { return chunk.code[starts[index] + 1 + byte]; }
+    int line(size_t index) const { return chunk.lines[starts[index]]; }
+    size_t jumpTarget(size_t offset) const;
+    bool matches(size_t index, std::initializer_list<OpCode> ops) const;
+    bool landsOnPop(size_t index) const;
+
+    void emit(uint8_t byte, int line) {
+        code.push_back(byte);
+        lines.push_back(line);
+    }
+    void emit(OpCode op, int line) { emit(static_cast<uint8_t>(op), line); }
+    void emitJump(OpCode op, size_t oldTarget, int line);
+};
+
+void Peephole::run() {
+    for (size_t offset = 0; offset < chunk.code.size(); offset += instruction_length(chunk, offset)) {
+        starts.push_back(offset);
+    }
+
+    targets.assign(chunk.code.size() + 1, false);
+    for (size_t offset : starts) {
+        OpCode op = static_cast<OpCode>(chunk.code[offset]);
+        if (!is_jump(op)) continue;
+        size_t target = jumpTarget(offset);
+        targets[target] = true;
+        // Where a fused condition jump would land instead
+        if (op == OpCode::JUMP_IF_FALSE && target < chunk.code.size() &&
+            chunk.code[target] == static_cast<uint8_t>(OpCode::POP)) {
+            targets[target + 1] = true;
+        }
+    }
+
+    code.reserve(chunk.code.size());
+    lines.reserve(chunk.code.size());
+    newOffsets.assign(chunk.code.size() + 1, NOT_AN_INSTRUCTION);
+    for (size_t index = 0; index < starts.size();) {
+        newOffsets[starts[index]] = static_cast<uint32_t>(code.size());
+        size_t fused = fuse(index);
+        if (fused == 0) {
+            copy(index);
+            fused = 1;
+        }
+        index += fused;
+    }
+    newOffsets[chunk.code.size()] = static_cast<uint32_t>(code.size());
+
+    // Code only got shorter, so every distance still fits in 16 bits
+    for (const Jump& jump : jumps) {
+        size_t after = jump.operand + 2;
+        size_t target = newOffsets[jump.oldTarget];
+        size_t distance = jump.backward ? after - target : target - after;
+        code[jump.operand] = static_cast<uint8_t>(distance >> 8);
+        code[jump.operand + 1] = static_cast<uint8_t>(distance);
+    }
+
+    chunk.code = std::move(code);
+    chunk.lines = std::move(lines);
+}
+
+// Returns how many instructions starting at `index` it replaced with one,
+// or 0 if none of the patterns start there
+size_t Peephole::fuse(size_t index) {
+    if (matches(index, {OpCode::GET_LOCAL, OpCode::CONSTANT, OpCode::ADD, OpCode::SET_LOCAL, OpCode::POP}) &&
+        operand(index, 0) == operand(index + 3, 0)) {
+        // Only the ADD can fail or allocate
+        int addLine = line(index + 2);
+        emit(OpCode::ADD_CONSTANT_TO_LOCAL, addLine);
+        emit(operand(index, 0), addLine);
+        emit(operand(index + 1, 0), addLine);
+        emit(operand(index + 1, 1), addLine);
+        return 5;
+    }
+
+    switch (op(index)) {
+        case OpCode::LESS:
+        case OpCode::LESS_EQUAL:
+        case OpCode::GREATER:
+        case OpCode::GREATER_EQUAL:
+            if (matches(index, {op(index), OpCode::JUMP_IF_FALSE, OpCode::POP}) && landsOnPop(index + 1)) {
+                emitJump(compare_and_jump(op(index)), jumpTarget(starts[index + 1]) + 1, line(index));
+                return 3;
+            }
+            return 0;
+
+        case OpCode::JUMP_IF_FALSE:
+            if (matches(index, {OpCode::JUMP_IF_FALSE, OpCode::POP}) && landsOnPop(index)) {
+                emitJump(OpCode::POP_JUMP_IF_FALSE, jumpTarget(starts[index]) + 1, line(index));
+                return 2;
+            }
+            return 0;
+
+        case OpCode::SET_LOCAL:
+            if (matches(index, {OpCode::SET_LOCAL, OpCode::POP})) {
+                emit(OpCode::SET_LOCAL_POP, line(index));
+                emit(operand(index, 0), line(index));
+                return 2;
+            }
+            return 0;
+
+        case OpCode::SET_PROPERTY:
+            if (matches(index, {OpCode::SET_PROPERTY, OpCode::POP})) {
+                emit(OpCode::SET_PROPERTY_POP, line(index));
+                for (size_t byte = 0; byte < 4; byte++) emit(operand(index, byte), line(index));
+                return 2;
+            }
+            return 0;
+
+        case OpCode::GET_LOCAL:
+            if (matches(index, {OpCode::GET_LOCAL, OpCode::GET_LOCAL})) {
+                emit(OpCode::GET_LOCAL_2, line(index));
+                emit(operand(index, 0), line(index));
+                emit(operand(index + 1, 0), line(index));
+                return 2;
+            }
+            if (matches(index, {OpCode::GET_LOCAL, OpCode::CONSTANT})) {
+                emit(OpCode::GET_LOCAL_CONSTANT, line(index));
+                emit(operand(index, 0), line(index));
+                emit(operand(index + 1, 0), line(index));
+                emit(operand(index + 1, 1), line(index));
+                return 2;
+            }
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+void Peephole::copy(size_t index) {
+    size_t offset = starts[index];
+    OpCode op = this->op(index);
+    if (is_jump(op)) {
+        emitJump(op, jumpTarget(offset), line(index));
+        return;
+    }
+    size_t end = offset + instruction_length(chunk, offset);
+    for (size_t at = offset; at < end; at++) {
+        emit(chunk.code[at], chunk.lines[at]);
+    }
+}
+
+size_t Peephole::jumpTarget(size_t offset) const {
+    size_t after = offset + 3;
+    uint16_t distance = read_short(chunk.code, offset + 1);
+    return static_cast<OpCode>(chunk.code[offset]) == OpCode::LOOP ? after - distance : after + distance;
+}
+
+// True if the instructions from `index` on are `ops`, and control can only
+// enter them at the first
+bool Peephole::matches(size_t index, std::initializer_list<OpCode> ops) const {
+    if (index + ops.size() > starts.size()) return false;
+    size_t i = index;
+    for (OpCode expected : ops) {
+        if (op(i) != expected || (i != index && targets[starts[i]])) return false;
+        i++;
+    }
+    return true;
+}
+
+// True if the JUMP_IF_FALSE at `index` jumps to a POP
+bool Peephole::landsOnPop(size_t index) const {
+    size_t target = jumpTarget(starts[index]);
+    return target < chunk.code.size() && chunk.code[target] == static_cast<uint8_t>(OpCode::POP);
+}
+
+void Peephole::emitJump(OpCode op, size_t oldTarget, int line) {
+    emit(op, line);
+    jumps.push_back({code.size(), oldTarget, op == OpCode::LOOP});
+    emit(0xff, line);
+    emit(0xff, line);
+}
+
+}
+
+void optimize_bytecode(ObjFunction* script) {
+    Peephole(script->chunk).run();
+    for (Value constant : script->chunk.constants) {
+        if (is_obj_type(constant, ObjType::FUNCTION)) {
+            optimize_bytecode(static_cast<ObjFunction*>(constant.asObject()));
+        }
+    }
+}
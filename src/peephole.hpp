@@ -0,0 +1,22 @@
+#pragma once
+
+#include "object.hpp"
+
+// Peephole pass over compiled bytecode, run on a script and every function
+// nested in it before the VM executes them. It fuses the instruction
+// sequences the `run --dump-opcode-pairs` profile of our workloads showed
+// most often into superinstructions, so each needs one dispatch instead of
+// several:
+//   - `i = i + k;` (GET_LOCAL, CONSTANT, ADD, SET_LOCAL, POP on one slot)
+//     becomes ADD_CONSTANT_TO_LOCAL
+//   - a relational comparison feeding a condition (LESS, JUMP_IF_FALSE,
+//     POP) becomes LESS_JUMP_IF_FALSE and friends, which never push the bool
+//   - any other JUMP_IF_FALSE, POP becomes POP_JUMP_IF_FALSE
+//   - an assignment statement's SET_LOCAL or SET_PROPERTY absorbs its POP
+//   - GET_LOCAL, GET_LOCAL and GET_LOCAL, CONSTANT load both at once
+// A condition jump is only fused when its target is the POP both paths
+// used to end in; the fused jump lands just past it. Nothing is fused across
+// the target of a jump, and fused instructions report errors against the
+// line of the instruction that can fail, so behaviour and error messages
+// are unchanged. Jumps are re-linked to the shorter code
+void optimize_bytecode(ObjFunction* script);
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "scanner.hpp"
+#include "spsc_ring.hpp"
+#include "stats.hpp"
+#include "token.hpp"
+
+// Below this size the cost of starting a thread outweighs any overlap
+constexpr std::size_t PIPELINE_MIN_BYTES = 1 << 20;
+
+constexpr std::size_t PIPELINE_BATCH_TOKENS = 1024;
+
+// Runs the scanner on a worker thread and hands each token batch to
+// `consume` on the calling thread while scanning carries on, so the total
+// time approaches max(scan, consume) rather than their sum
+template <typename Consume>
+void scan_pipelined(const std::string& source, Consume&& consume) {
+    using Batch = std::vector<Token>;
+    SpscRing<Batch, 64> ring;
+
+    std::jthread producer([&] {
+        LOX_STATS_PHASE(Phase::SCAN);
+        Scanner scanner(source);
+        scanner.scanTokens(PIPELINE_BATCH_TOKENS, [&](Batch&& batch) {
+            while (!ring.tryPush(std::move(batch))) std::this_thread::yield();
+        });
+    });
+
+    Batch batch;
+    bool done = false;
+    while (!done) {
+        if (!ring.tryPop(batch)) {
+            std::this_thread::yield();
+            continue;
+        }
+        done = !batch.empty() && batch.back().type == TokenType::END_OF_FILE;
+        consume(std::as_const(batch));
+    }
+}
@@ -0,0 +1,299 @@
+#include "resolver.hpp"
+
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "error.hpp"
+#include "natives.hpp"
+
+namespace {
+
+enum class FunctionType : uint8_t { NONE, FUNCTION, METHOD, INITIALIZER };
+enum class ClassType : uint8_t { NONE, CLASS, SUBCLASS };
+
+class Resolver {
+public:
+    explicit Resolver(Ast& ast);
+
+    void resolveRoot();
+
+private:
+    // A scope's names in slot order, and whether each one's initializer
+    // has finished (so `var a = a;` can be caught)
+    using Scope = std::vector<std::pair<std::string_view, bool>>;
+
+    Ast& ast;
+    std::vector<Scope> scopes;
+    std::unordered_map<std::string_view, uint32_t> globals;
+    FunctionType currentFunction = FunctionType::NONE;
+    ClassType currentClass = ClassType::NONE;
+
+    void statement(NodeIndex index);
+    void expression(NodeIndex index);
+    void function(const Node& node, FunctionType type);
+    void statements(std::span<const NodeIndex> list);
+
+    void beginScope() { scopes.emplace_back(); }
+    uint32_t endScope();
+    void declare(NodeIndex node, std::string_view name);
+    void define(std::string_view name);
+    void resolveName(NodeIndex node, std::string_view name);
+    uint32_t global(std::string_view name);
+
+    std::string_view name(const Node& node) const { return ast.token(node).lexeme; }
+    void error(const Node& node, const std::string& message);
+    void error(uint32_t token, const std::string& message);
+};
+
+Resolver::Resolver(Ast& ast) : ast(ast) {
+    ast.bindings.assign(ast.nodes.size(), Binding{});
+    for (const NativeDef& native : natives()) {
+        global(native.name);
+    }
+}
+
+void Resolver::resolveRoot() {
+    if (ast.root == NO_NODE) return;
+    if (ast[ast.root].kind == NodeKind::PROGRAM) {
+        statement(ast.root);
+    }
+    else {
+        expression(ast.root);
+    }
+    ast.globalCount = static_cast<uint32_t>(globals.size());
+}
+
+void Resolver::statement(NodeIndex index) {
+    const Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::PROGRAM:
+            statements(ast.list(node.a, node.b));
+            break;
+
+        case NodeKind::BLOCK:
+            beginScope();
+            statements(ast.list(node.a, node.b));
+            ast.bindings[index].slot = endScope();
+            break;
+
+        case NodeKind::VAR:
+            declare(index, name(node));
+            if (node.a != NO_NODE) expression(node.a);
+            define(name(node));
+            break;
+
+        case NodeKind::FUNCTION:
+            // Defined before the body is resolved, so it can call itself
+            declare(index, name(node));
+            define(name(node));
+            function(node, FunctionType::FUNCTION);
+            break;
+
+        case NodeKind::CLASS: {
+            ClassType enclosingClass = currentClass;
+            currentClass = ClassType::CLASS;
+            declare(index, name(node));
+            define(name(node));
+
+            if (node.a != NO_NODE) {
+                if (name(ast[node.a]) == name(node)) {
+                    error(ast[node.a], "A class can't inherit from itself.");
+                }
+                currentClass = ClassType::SUBCLASS;
+                expression(node.a);
+
+                beginScope();
+                define("super");
+            }
+
+            beginScope();
+            define("this");
+            for (NodeIndex methodIndex : ast.list(node.b, node.c)) {
+                const Node& method = ast[methodIndex];
+                function(method, name(method) == "init" ? FunctionType::INITIALIZER : FunctionType::METHOD);
+            }
+            endScope();
+
+            if (node.a != NO_NODE) endScope();
+            currentClass = enclosingClass;
+            break;
+        }
+
+        case NodeKind::RETURN:
+            if (currentFunction == FunctionType::NONE) {
+                error(node, "Can't return from top-level code.");
+            }
+            if (node.a != NO_NODE) {
+                if (currentFunction == FunctionType::INITIALIZER) {
+                    error(node, "Can't return a value from an initializer.");
+                }
+                expression(node.a);
+            }
+            break;
+
+        case NodeKind::IF:
+            expression(node.a);
+            statement(node.b);
+            if (node.c != NO_NODE) statement(node.c);
+            break;
+
+        case NodeKind::WHILE:
+            expression(node.a);
+            statement(node.b);
+            break;
+
+        default:
+            for_each_child(ast, node, [&](NodeIndex child) { expression(child); });
+            break;
+    }
+}
+
+void Resolver::statements(std::span<const NodeIndex> list) {
+    for (NodeIndex statement : list) {
+        this->statement(statement);
+    }
+}
+
+// Parameters and the body's own declarations share one scope, which is
+// the environment the interpreter creates for each call
+void Resolver::function(const Node& node, FunctionType type) {
+    FunctionType enclosingFunction = currentFunction;
+    currentFunction = type;
+
+    beginScope();
+    for (NodeIndex parameter : ast.list(node.a, node.b)) {
+        std::string_view parameterName = ast.tokens[parameter].lexeme;
+        for (const auto& [existing, defined] : scopes.back()) {
+            if (existing == parameterName) {
+                report(ast.tokens[parameter].line, " at '" + std::string(parameterName) + "'",
+                       "Already a variable with this name in this scope.");
+            }
+        }
+        define(parameterName);
+    }
+    const Node& body = ast[node.c];
+    statements(ast.list(body.a, body.b));
+    ast.bindings[node.c].slot = endScope();
+
+    currentFunction = enclosingFunction;
+}
+
+void Resolver::expression(NodeIndex index) {
+    const Node& node = ast[index];
+    switch (node.kind) {
+        case NodeKind::VARIABLE:
+            if (!scopes.empty()) {
+                for (const auto& [existing, defined] : scopes.back()) {
+                    if (existing == name(node) && !defined) {
+                        error(node, "Can't read local variable in its own initializer.");
+                    }
+                }
+            }
+            resolveName(index, name(node));
+            break;
+
+        case NodeKind::ASSIGN:
+            expression(node.a);
+            resolveName(index, name(node));
+            break;
+
+        case NodeKind::THIS:
+            if (currentClass == ClassType::NONE) {
+                error(node, "Can't use 'this' outside of a class.");
+                break;
+            }
+            resolveName(index, "this");
+            break;
+
+        // Reported at `super` itself, like the bytecode compiler does
+        case NodeKind::SUPER:
+            if (currentClass == ClassType::NONE) {
+                error(node.a, "Can't use 'super' outside of a class.");
+            }
+            else if (currentClass != ClassType::SUBCLASS) {
+                error(node.a, "Can't use 'super' in a class with no superclass.");
+            }
+            resolveName(index, "super");
+            break;
+
+        default:
+            for_each_child(ast, node, [&](NodeIndex child) { expression(child); });
+            break;
+    }
+}
+
+uint32_t Resolver::endScope() {
+    uint32_t slotCount = static_cast<uint32_t>(scopes.back().size());
+    scopes.pop_back();
+    return slotCount;
+}
+
+// Top-level declarations are globals; anything nested gets the next slot
+// of the innermost scope
+void Resolver::declare(NodeIndex node, std::string_view name) {
+    if (scopes.empty()) {
+        ast.bindings[node] = {GLOBAL, global(name)};
+        return;
+    }
+
+    Scope& scope = scopes.back();
+    for (const auto& [existing, defined] : scope) {
+        if (existing == name) {
+            error(ast[node], "Already a variable with this name in this scope.");
+        }
+    }
+    ast.bindings[node] = {0, static_cast<uint32_t>(scope.size())};
+    scope.emplace_back(name, false);
+}
+
+void Resolver::define(std::string_view name) {
+    if (scopes.empty()) return;
+
+    // declare() has already added the slot unless this is a parameter or
+    // one of the implicit `this` and `super` locals
+    Scope& scope = scopes.back();
+    for (auto it = scope.rbegin(); it != scope.rend(); ++it) {
+        if (it->first == name && !it->second) {
+            it->second = true;
+            return;
+        }
+    }
+    scope.emplace_back(name, true);
+}
+
+void Resolver::resolveName(NodeIndex node, std::string_view name) {
+    for (size_t i = scopes.size(); i-- > 0;) {
+        const Scope& scope = scopes[i];
+        for (size_t slot = scope.size(); slot-- > 0;) {
+            if (scope[slot].first == name) {
+                ast.bindings[node] = {static_cast<uint32_t>(scopes.size() - 1 - i), static_cast<uint32_t>(slot)};
+                return;
+            }
+        }
+    }
+    // Not found: assume it's a global that will be defined by the time
+    // this runs, and let the interpreter complain if it isn't
+    ast.bindings[node] = {GLOBAL, global(name)};
+}
+
+uint32_t Resolver::global(std::string_view name) {
+    auto [it, inserted] = globals.try_emplace(name, static_cast<uint32_t>(globals.size()));
+    return it->second;
+}
+
+void Resolver::error(const Node& node, const std::string& message) {
+    error(node.token, message);
+}
+
+void Resolver::error(uint32_t token, const std::string& message) {
+    report(ast.tokens[token].line, " at '" + ast.tokens[token].lexeme + "'", message);
+}
+
+}
+
+void resolve(Ast& ast) {
+    Resolver resolver(ast);
+    resolver.resolveRoot();
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "ast.hpp"
+
+// Static pass between parsing and the tree-walker. It fills in
+// ast.bindings so that at runtime a local is found by walking a known
+// number of environments out and indexing a slot, and a global by indexing
+// a dense array: no name is ever hashed or compared while the program runs.
+// Natives are numbered first, in the order natives() lists them.
+//
+// It also reports the errors that need scope information: reading a local
+// in its own initializer, redeclaring a local, `return` outside a
+// function, a value returned from an initializer, and misplaced `this` and
+// `super`. Errors set had_error like syntax errors do
+void resolve(Ast& ast);
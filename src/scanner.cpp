@@ -0,0 +1,156 @@
+#include "scanner.hpp"
+
+#include "error.hpp"
+#include "stats.hpp"
+
+std::vector<Token> Scanner::scanTokens() {
+    LOX_TRACE_SPAN("scanTokens");
+    LOX_TRACE_SCAN_START(source.size());
+    while (!isAtEnd()) {
+        start = current;
+        scanToken();
+    }
+    tokens.push_back(Token(TokenType::END_OF_FILE, "", "", line));
+    LOX_TRACE_SCAN_END(tokens.size(), line);
+    return tokens;
+}
+
+void Scanner::scanToken() {
+    char c = advance();
+    switch (c) {
+        case '(': addToken(TokenType::LEFT_PAREN); break;
+        case ')': addToken(TokenType::RIGHT_PAREN); break;
+        case '{': addToken(TokenType::LEFT_BRACE); break;
+        case '}': addToken(TokenType::RIGHT_BRACE); break;
+        case ',': addToken(TokenType::COMMA); break;
+        case '.': addToken(TokenType::DOT); break;
+        case '-': addToken(TokenType::MINUS); break;
+        case '+': addToken(TokenType::PLUS); break;
+        case ';': addToken(TokenType::SEMICOLON); break;
+        case '*': addToken(TokenType::STAR); break;
+        case '!':
+            addToken(match('=') ? TokenType::BANG_EQUAL : TokenType::BANG);
+            break;
+        case '=':
+            addToken(match('=') ? TokenType::EQUAL_EQUAL : TokenType::EQUAL);
+            break;
+        case '<':
+            addToken(match('=') ? TokenType::LESS_EQUAL : TokenType::LESS);
+            break;
+        case '>':
+            addToken(match('=') ? TokenType::GREATER_EQUAL : TokenType::GREATER);
+            break;
+
+        // Two slashes make a comment in Lox: the scanner advances until
+        // it finds the line end
+        case '/':
+            if (match('/')) {
+                while (peek() != '\n' && !isAtEnd()) advance();
+            }
+            else {
+                addToken(TokenType::SLASH);
+            }
+            break;
+
+        case ' ':
+        case '\r':
+        case '\t':
+            // Skip whitespace
+            break;
+        case '\n':
+            line++;
+            break;
+
+        case '"':
+            string();
+            break;
+
+        default:
+            if (isDigit(c)) {
+                number();
+            }
+            else if (isAlpha(c)) {
+                identifier();
+            }
+            else {
+                error(line, "Unexpected character");
+            }
+            break;
+    }
+}
+
+// Some (simple) tokens do not have literal values, e.g. braces, semicolons
+void Scanner::addToken(TokenType type) {
+    addToken(type, "");
+}
+
+// But some tokens do, e.g. strings, numerics, necessitating function overloading
+void Scanner::addToken(TokenType type, const std::string& literal) {
+    std::string text = source.substr(start, current - start);
+    LOX_STATS_VECTOR_PUSH(tokens);
+    tokens.push_back(Token(type, text, literal, line));
+}
+
+// Processes a string literal
+void Scanner::string() {
+    while (peek() != '"' && !isAtEnd()) {
+        if (peek() == '\n') line++;
+        advance();
+    }
+
+    if (isAtEnd()) {
+        error(line, "Unterminated string.");
+        return;
+    }
+
+    // For the closing quote
+    advance();
+
+    // Extract the string value (without the quotes)
+    std::string value = source.substr(start + 1, current - start - 2);
+    addToken(TokenType::STRING, value);
+}
+
+// Process a number literal
+void Scanner::number() {
+    while (isDigit(peek())) advance();
+
+    // Look for a fractional part
+    if (peek() == '.' && isDigit(peekNext())) {
+        advance();  // Consume the dot
+        while (isDigit(peek())) advance();
+    }
+
+    std::string numberStr = source.substr(start, current - start);
+    addToken(TokenType::NUMBER, numberStr);
+}
+
+// Process an identifier or keyword
+void Scanner::identifier() {
+    while (isAlphaNumeric(peek())) advance();
+
+    std::string text = source.substr(start, current - start);
+    TokenType type = identifierType(text);
+    addToken(type);
+}
+
+// Determine if the identifier is a reserved keyword
+TokenType Scanner::identifierType(const std::string& text) {
+    if (text == "if") return TokenType::IF;
+    if (text == "else") return TokenType::ELSE;
+    if (text == "while") return TokenType::WHILE;
+    if (text == "for") return TokenType::FOR;
+    if (text == "return") return TokenType::RETURN;
+    if (text == "true") return TokenType::TRUE;
+    if (text == "false") return TokenType::FALSE;
+    if (text == "and") return TokenType::AND;
+    if (text == "class") return TokenType::CLASS;
+    if (text == "fun") return TokenType::FUN;
+    if (text == "nil") return TokenType::NIL;
+    if (text == "or") return TokenType::OR;
+    if (text == "print") return TokenType::PRINT;
+    if (text == "super") return TokenType::SUPER;
+    if (text == "this") return TokenType::THIS;
+    if (text == "var") return TokenType::VAR;
+    return TokenType::IDENTIFIER;
+}
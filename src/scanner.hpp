@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cctype>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "token.hpp"
+#include "trace.hpp"
+
+class Scanner {
+public:
+    /* C++ curiosity: whenever you write a constructor with one parameter,
+    it can be used as a 'converting constructor', i.e. 
+    if class Foo has a constructor of the form Foo(int x) {}, then
+    if for some method bar(Foo foo), we can simply pass the int to bar
+    and the compiler will make the implicit conversion
+    (as long as there's only one)
+    
+    Using the keyword 'explicit' prevents the compiler from doing that,
+    making the programme's behaviour a bit more predictable */
+    explicit Scanner(const std::string& source) : source(source) {}
+
+    std::vector<Token> scanTokens();
+
+    // Same scan, but hands tokens over in batches of `batchSize` as soon as
+    // each batch fills up, so a consumer can start before scanning finishes.
+    // The last batch always ends with the END_OF_FILE token
+    template <typename Emit>
+    void scanTokens(std::size_t batchSize, Emit&& emit) {
+        LOX_TRACE_SPAN("scanTokens");
+        LOX_TRACE_SCAN_START(source.size());
+        std::size_t emitted = 0;
+        tokens.reserve(batchSize);
+        while (!isAtEnd()) {
+            start = current;
+            scanToken();
+            if (tokens.size() >= batchSize) {
+                emitted += tokens.size();
+                LOX_TRACE_TOKEN_BATCH(tokens.size());
+                emit(std::move(tokens));
+                tokens.clear();
+                tokens.reserve(batchSize);
+            }
+        }
+        tokens.push_back(Token(TokenType::END_OF_FILE, "", "", line));
+        emitted += tokens.size();
+        LOX_TRACE_TOKEN_BATCH(tokens.size());
+        emit(std::move(tokens));
+        tokens.clear();
+        LOX_TRACE_SCAN_END(emitted, line);
+    }
+
+private:
+    const std::string source;
+    std::vector<Token> tokens;
+    int start = 0;
+    int current = 0;
+    int line = 1;
+
+    bool isAtEnd() const {
+        return current >= source.size();
+    }
+
+    // The hot loop body lives in scanner.cpp rather than here so that every
+    // binary linking the lox library runs (and PGO profiles) the same copy
+    void scanToken();
+
+    // Returns the current character and advances the pointer
+    // Programming nuance: current++ executes the statement involving
+    // the incremented variable then increments
+    // ++current increments THEN executes
+    char advance() {
+        return source[current++];
+    }
+
+    void addToken(TokenType type);
+    void addToken(TokenType type, const std::string& literal);
+
+    // Conditionally consumes the next character if it matches `expected`
+    bool match(char expected) {
+        if (isAtEnd() || source[current] != expected) return false;
+        current++;
+        return true;
+    }
+
+    // Looks at the current character without consuming it
+    char peek() const {
+        if (isAtEnd()) return '\0';
+        return source[current];
+    }
+
+    // Peeks at the next character
+    char peekNext() const {
+        if (current + 1 >= source.size()) return '\0';
+        return source[current + 1];
+    }
+
+    void string();
+    void number();
+    void identifier();
+    TokenType identifierType(const std::string& text);
+
+    bool isDigit(char c) {
+        return std::isdigit(static_cast<unsigned char>(c));
+    }
+
+    bool isAlpha(char c) {
+        return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+    }
+
+    bool isAlphaNumeric(char c) {
+        return isAlpha(c) || isDigit(c);
+    }
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, so a pair of
+// acquire/release atomics is all the synchronisation needed
+template <typename T, std::size_t Capacity>
+class SpscRing {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                  "Capacity must be a power of two");
+
+public:
+    // Producer side. Returns false instead of blocking when the ring is full
+    bool tryPush(T&& value) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cachedHead == Capacity) {
+            cachedHead = head_.load(std::memory_order_acquire);
+            if (tail - cachedHead == Capacity) return false;
+        }
+        slots[tail & (Capacity - 1)] = std::move(value);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false instead of blocking when the ring is empty
+    bool tryPop(T& out) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail) {
+            cachedTail = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail) return false;
+        }
+        out = std::move(slots[head & (Capacity - 1)]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Each index sits on its own cache line next to the owning side's cached
+    // copy of the other index, so the two threads don't keep stealing the
+    // same line from each other
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    alignas(CACHE_LINE) std::atomic<std::size_t> head_{0};
+    std::size_t cachedTail = 0;
+
+    alignas(CACHE_LINE) std::atomic<std::size_t> tail_{0};
+    std::size_t cachedHead = 0;
+
+    alignas(CACHE_LINE) std::array<T, Capacity> slots;
+};
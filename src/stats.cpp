@@ -0,0 +1,198 @@
+#include "stats.hpp"
+
+#include <sys/resource.h>
+
+#include <cstdio>
+
+RunStats run_stats;
+
+namespace {
+
+const char* phase_label(Phase phase) {
+    switch (phase) {
+        case Phase::READ: return "read_file_contents";
+        case Phase::CACHE: return "bytecode_cache";
+        case Phase::SCAN: return "scanTokens";
+        case Phase::PARSE: return "parse";
+        case Phase::RESOLVE: return "resolve";
+        case Phase::OPTIMIZE: return "optimize";
+        case Phase::EXECUTE: return "execute";
+        case Phase::FORMAT: return "format";
+        case Phase::EXIT: return "exit";
+    }
+    return "";
+}
+
+uint64_t total_tokens() {
+    uint64_t total = 0;
+    for (uint64_t count : run_stats.token_counts) total += count;
+    return total;
+}
+
+// Throughput is relative to scanning alone, the phase the numbers are
+// meant to track across commits
+double per_scan_second(double amount) {
+    uint64_t scan_ns = run_stats.phase_ns[static_cast<size_t>(Phase::SCAN)];
+    return scan_ns == 0 ? 0.0 : amount * 1e9 / scan_ns;
+}
+
+uint64_t peak_rss_bytes() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+#ifdef LOX_ALLOC_STATS
+double ratio(uint64_t numerator, uint64_t denominator) {
+    return denominator == 0 ? 0.0 : static_cast<double>(numerator) / denominator;
+}
+#endif
+
+void print_memory(std::FILE* out, [[maybe_unused]] uint64_t tokens) {
+    std::fprintf(out, "[stats] peak RSS %.1f MiB\n", peak_rss_bytes() / 1048576.0);
+#ifdef LOX_ALLOC_STATS
+    AllocCounters counters = alloc_counters();
+    std::fprintf(out, "[stats] %llu allocations, %llu frees, %llu bytes allocated, peak heap %.1f MiB\n",
+                 static_cast<unsigned long long>(counters.allocations),
+                 static_cast<unsigned long long>(counters.frees),
+                 static_cast<unsigned long long>(counters.bytes_allocated),
+                 counters.peak_live_bytes / 1048576.0);
+    std::fprintf(out, "[stats] %.2f allocations/token, %.2f bytes allocated/input byte, "
+                      "%llu token vector reallocations\n",
+                 ratio(counters.allocations, tokens), ratio(counters.bytes_allocated, run_stats.bytes),
+                 static_cast<unsigned long long>(run_stats.vector_reallocations));
+#endif
+}
+
+void print_report(std::FILE* out) {
+    uint64_t total_ns = 0;
+    for (auto phase : magic_enum::enum_values<Phase>()) {
+        uint64_t ns = run_stats.phase_ns[static_cast<size_t>(phase)];
+        // Each command only goes through some of the phases
+        if (ns == 0) continue;
+        total_ns += ns;
+        std::fprintf(out, "[stats] %-20s %12.3f ms\n", phase_label(phase), ns / 1e6);
+    }
+    std::fprintf(out, "[stats] %-20s %12.3f ms\n", "total", total_ns / 1e6);
+
+    uint64_t tokens = total_tokens();
+    std::fprintf(out, "[stats] %llu bytes, %llu tokens, %.2f MB/s, %.0f tokens/s\n",
+                 static_cast<unsigned long long>(run_stats.bytes),
+                 static_cast<unsigned long long>(tokens),
+                 per_scan_second(run_stats.bytes) / 1e6, per_scan_second(tokens));
+    if (run_stats.ast_nodes > 0) {
+        std::fprintf(out, "[stats] constant folding removed %llu of %llu AST nodes\n",
+                     static_cast<unsigned long long>(run_stats.ast_nodes_removed),
+                     static_cast<unsigned long long>(run_stats.ast_nodes));
+    }
+    if (run_stats.frame_allocation_sites > 0) {
+        std::fprintf(out, "[stats] escape analysis: %llu construction sites build their instance in the frame\n",
+                     static_cast<unsigned long long>(run_stats.frame_allocation_sites));
+    }
+    if (run_stats.gc_objects_allocated > 0) {
+        std::fprintf(out, "[stats] heap: %llu objects allocated, %llu bytes\n",
+                     static_cast<unsigned long long>(run_stats.gc_objects_allocated),
+                     static_cast<unsigned long long>(run_stats.gc_bytes_allocated));
+    }
+    if (run_stats.gc_collections > 0) {
+        std::fprintf(out, "[stats] gc: %llu collections, %.3f ms paused (max %.3f ms), %.3f ms sweeping\n",
+                     static_cast<unsigned long long>(run_stats.gc_collections), run_stats.gc_pause_ns / 1e6,
+                     run_stats.gc_max_pause_ns / 1e6, run_stats.gc_sweep_ns / 1e6);
+        std::fprintf(out, "[stats] gc: %llu bytes reclaimed, %llu bytes live after the last collection\n",
+                     static_cast<unsigned long long>(run_stats.gc_bytes_reclaimed),
+                     static_cast<unsigned long long>(run_stats.gc_live_bytes));
+    }
+    if (run_stats.ic_misses > 0) {
+        std::fprintf(out, "[stats] inline caches: %llu misses, %llu sites megamorphic\n",
+                     static_cast<unsigned long long>(run_stats.ic_misses),
+                     static_cast<unsigned long long>(run_stats.ic_megamorphic));
+    }
+    if (run_stats.quickened > 0) {
+        std::fprintf(out, "[stats] quickening: %llu additions specialized, %llu fell back to generic\n",
+                     static_cast<unsigned long long>(run_stats.quickened),
+                     static_cast<unsigned long long>(run_stats.deoptimized));
+    }
+    print_memory(out, tokens);
+
+    for (auto type : magic_enum::enum_values<TokenType>()) {
+        uint64_t count = run_stats.token_counts[static_cast<size_t>(type)];
+        if (count == 0) continue;
+        std::fprintf(out, "[stats]   %-16s %llu\n",
+                     std::string(token_type_name(type)).c_str(),
+                     static_cast<unsigned long long>(count));
+    }
+}
+
+void write_json(std::FILE* out) {
+    std::fprintf(out, "{\n  \"phases_ns\": {");
+    const char* separator = "";
+    for (auto phase : magic_enum::enum_values<Phase>()) {
+        std::fprintf(out, "%s\"%s\": %llu", separator, phase_label(phase),
+                     static_cast<unsigned long long>(run_stats.phase_ns[static_cast<size_t>(phase)]));
+        separator = ", ";
+    }
+
+    uint64_t tokens = total_tokens();
+    std::fprintf(out, "},\n  \"bytes\": %llu,\n  \"tokens\": %llu,\n"
+                      "  \"mb_per_s\": %.3f,\n  \"tokens_per_s\": %.0f,\n",
+                 static_cast<unsigned long long>(run_stats.bytes),
+                 static_cast<unsigned long long>(tokens),
+                 per_scan_second(run_stats.bytes) / 1e6, per_scan_second(tokens));
+
+    std::fprintf(out, "  \"ast_nodes\": %llu,\n  \"ast_nodes_removed\": %llu,\n  \"frame_allocation_sites\": %llu,\n",
+                 static_cast<unsigned long long>(run_stats.ast_nodes),
+                 static_cast<unsigned long long>(run_stats.ast_nodes_removed),
+                 static_cast<unsigned long long>(run_stats.frame_allocation_sites));
+    std::fprintf(out, "  \"gc_collections\": %llu,\n  \"gc_pause_ns\": %llu,\n  \"gc_max_pause_ns\": %llu,\n"
+                      "  \"gc_sweep_ns\": %llu,\n  \"gc_bytes_reclaimed\": %llu,\n  \"gc_live_bytes\": %llu,\n",
+                 static_cast<unsigned long long>(run_stats.gc_collections),
+                 static_cast<unsigned long long>(run_stats.gc_pause_ns),
+                 static_cast<unsigned long long>(run_stats.gc_max_pause_ns),
+                 static_cast<unsigned long long>(run_stats.gc_sweep_ns),
+                 static_cast<unsigned long long>(run_stats.gc_bytes_reclaimed),
+                 static_cast<unsigned long long>(run_stats.gc_live_bytes));
+    std::fprintf(out, "  \"gc_objects_allocated\": %llu,\n  \"gc_bytes_allocated\": %llu,\n",
+                 static_cast<unsigned long long>(run_stats.gc_objects_allocated),
+                 static_cast<unsigned long long>(run_stats.gc_bytes_allocated));
+    std::fprintf(out, "  \"ic_misses\": %llu,\n  \"ic_megamorphic\": %llu,\n",
+                 static_cast<unsigned long long>(run_stats.ic_misses),
+                 static_cast<unsigned long long>(run_stats.ic_megamorphic));
+    std::fprintf(out, "  \"quickened\": %llu,\n  \"deoptimized\": %llu,\n",
+                 static_cast<unsigned long long>(run_stats.quickened),
+                 static_cast<unsigned long long>(run_stats.deoptimized));
+    std::fprintf(out, "  \"peak_rss_bytes\": %llu,\n", static_cast<unsigned long long>(peak_rss_bytes()));
+#ifdef LOX_ALLOC_STATS
+    AllocCounters counters = alloc_counters();
+    std::fprintf(out, "  \"allocations\": %llu,\n  \"frees\": %llu,\n  \"bytes_allocated\": %llu,\n"
+                      "  \"peak_heap_bytes\": %llu,\n  \"allocations_per_token\": %.3f,\n"
+                      "  \"bytes_allocated_per_input_byte\": %.3f,\n  \"vector_reallocations\": %llu,\n",
+                 static_cast<unsigned long long>(counters.allocations),
+                 static_cast<unsigned long long>(counters.frees),
+                 static_cast<unsigned long long>(counters.bytes_allocated),
+                 static_cast<unsigned long long>(counters.peak_live_bytes),
+                 ratio(counters.allocations, tokens), ratio(counters.bytes_allocated, run_stats.bytes),
+                 static_cast<unsigned long long>(run_stats.vector_reallocations));
+#endif
+    std::fprintf(out, "  \"token_counts\": {");
+    separator = "";
+    for (auto type : magic_enum::enum_values<TokenType>()) {
+        std::fprintf(out, "%s\"%s\": %llu", separator, std::string(token_type_name(type)).c_str(),
+                     static_cast<unsigned long long>(run_stats.token_counts[static_cast<size_t>(type)]));
+        separator = ", ";
+    }
+    std::fprintf(out, "}\n}\n");
+}
+
+}
+
+bool report_stats(const std::string& json_path) {
+    if (json_path.empty()) {
+        print_report(stderr);
+        return true;
+    }
+
+    std::FILE* out = std::fopen(json_path.c_str(), "w");
+    if (!out) return false;
+    write_json(out);
+    return std::fclose(out) == 0;
+}
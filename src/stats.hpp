@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "token.hpp"
+
+// Per-phase timing and token counts for `tokenize --stats` and
+// `run --stats`. With the
+// LOX_STATS build option off, the LOX_STATS_* hooks below expand to nothing
+// and none of this is touched on the hot paths.
+//
+// On the pipelined path scanning overlaps formatting, so the scan phase
+// there also includes time spent waiting for room in the token ring
+
+enum class Phase { READ, CACHE, SCAN, PARSE, RESOLVE, OPTIMIZE, EXECUTE, FORMAT, EXIT };
+
+struct RunStats {
+    bool enabled = false;
+    uint64_t phase_ns[magic_enum::enum_count<Phase>()] = {};
+    uint64_t bytes = 0;
+    uint64_t token_counts[magic_enum::enum_count<TokenType>()] = {};
+    uint64_t vector_reallocations = 0;
+    // Size of the parsed program, and how much of it constant folding removed
+    uint64_t ast_nodes = 0;
+    uint64_t ast_nodes_removed = 0;
+    // Construction sites escape analysis moved off the heap
+    uint64_t frame_allocation_sites = 0;
+    // Garbage collector activity. Pauses are the stop-the-world marking;
+    // sweeping happens lazily during allocation and is timed separately
+    uint64_t gc_collections = 0;
+    uint64_t gc_pause_ns = 0;
+    uint64_t gc_max_pause_ns = 0;
+    uint64_t gc_sweep_ns = 0;
+    uint64_t gc_bytes_reclaimed = 0;
+    uint64_t gc_live_bytes = 0;  // what survived the last collection
+    uint64_t gc_objects_allocated = 0;
+    uint64_t gc_bytes_allocated = 0;
+    // VM property lookups that missed their inline cache, and cached sites
+    // that saw too many shapes and gave up caching
+    uint64_t ic_misses = 0;
+    uint64_t ic_megamorphic = 0;
+    // ADD instructions the VM rewrote for the operand types they saw, and
+    // specialized ones that later saw other types and went back to generic
+    uint64_t quickened = 0;
+    uint64_t deoptimized = 0;
+};
+
+extern RunStats run_stats;
+
+// Adds the time between construction and destruction to `phase`. Adding
+// rather than storing lets a phase be split over several scopes, e.g. the
+// per-batch formatting in the pipelined path
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase) : phase(phase) {
+        if (run_stats.enabled) started = std::chrono::steady_clock::now();
+    }
+
+    ~PhaseTimer() {
+        if (!run_stats.enabled) return;
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        run_stats.phase_ns[static_cast<size_t>(phase)] +=
+            std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    Phase phase;
+    std::chrono::steady_clock::time_point started;
+};
+
+// Heap traffic seen by the replacement operator new/delete in
+// alloc_stats.cpp. Only counted in LOX_ALLOC_STATS builds
+struct AllocCounters {
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    uint64_t bytes_allocated = 0;
+    uint64_t peak_live_bytes = 0;
+};
+
+AllocCounters alloc_counters();
+
+// Prints the report to stderr, or writes it as JSON to `json_path` if set.
+// Returns false if the JSON file can't be written
+bool report_stats(const std::string& json_path);
+
+#ifdef LOX_STATS
+#define LOX_STATS_PHASE(phase) PhaseTimer stats_phase_timer_(phase)
+#define LOX_STATS_BYTES(count) (run_stats.bytes += (count))
+#define LOX_STATS_COUNT_TOKEN(type) \
+    (run_stats.enabled ? void(run_stats.token_counts[static_cast<size_t>(type)]++) : void())
+// Adds to one of the RunStats counters, when --stats asked for them
+#define LOX_STATS_ADD(counter, amount) (run_stats.enabled ? void(run_stats.counter += (amount)) : void())
+#else
+#define LOX_STATS_PHASE(phase) ((void)0)
+#define LOX_STATS_BYTES(count) ((void)0)
+#define LOX_STATS_COUNT_TOKEN(type) ((void)(type))
+#define LOX_STATS_ADD(counter, amount) ((void)0)
+#endif
+
+// Call right before a push_back: a full vector is about to reallocate
+#ifdef LOX_ALLOC_STATS
+#define LOX_STATS_VECTOR_PUSH(vector) \
+    ((vector).size() == (vector).capacity() ? void(run_stats.vector_reallocations++) : void())
+#else
+#define LOX_STATS_VECTOR_PUSH(vector) ((void)0)
+#endif
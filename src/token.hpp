@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <string_view>
+// Regular enum classes can't return the keyword the enum
+// associates with the integer value
+#include "magic_enum.hpp"
+
+// Define the different kinds of tokens our language supports.
+// One byte is plenty, and keeps AST nodes that store an operator small
+enum class TokenType : uint8_t {
+    // Single-character tokens
+    LEFT_PAREN, RIGHT_PAREN, LEFT_BRACE, RIGHT_BRACE,
+    COMMA, DOT, MINUS, PLUS, SEMICOLON, SLASH, STAR,
+
+    // One or two character tokens
+    BANG, BANG_EQUAL,
+    EQUAL, EQUAL_EQUAL,
+    GREATER, GREATER_EQUAL,
+    LESS, LESS_EQUAL,
+
+    // Literals.
+    IDENTIFIER, STRING, NUMBER,
+
+    // Keywords.
+    IF, ELSE, WHILE, FOR, RETURN, TRUE, FALSE,
+    AND, CLASS, FUN, NIL, OR, PRINT, SUPER, THIS, VAR,
+
+    // End-of-file.
+    END_OF_FILE
+};
+
+struct Token {
+    TokenType     type;
+    std::string   lexeme;
+    std::string   literal;
+    int           line;
+
+    Token(TokenType type, const std::string& lexeme, const std::string& literal, int line)
+        : type(type), lexeme(lexeme), literal(literal), line(line) {}
+};
+
+// The `tokenize` output spells END_OF_FILE as "EOF"
+inline std::string_view token_type_name(TokenType type) {
+    if (type == TokenType::END_OF_FILE) return "EOF";
+    return magic_enum::enum_name(type);
+}
+
+// Tokens without a literal value print it as "null"
+inline std::string_view token_literal(const Token& token) {
+    if (token.literal == "") return "null";
+    return token.literal;
+}
+
+// Prints a token the way the `tokenize` command expects it:
+// TYPE lexeme literal
+inline std::ostream& operator<<(std::ostream& out, const Token& token) {
+    return out << token_type_name(token.type) << " " << token.lexeme << " "
+        << token_literal(token);
+}
@@ -0,0 +1,56 @@
+#include "trace.hpp"
+
+#include <unistd.h>
+
+ChromeTrace chrome_trace;
+
+namespace {
+
+// trace_event wants a thread id per event so the producer and consumer of
+// the pipelined path end up on separate tracks
+long thread_id() {
+    thread_local long id = gettid();
+    return id;
+}
+
+}
+
+bool ChromeTrace::open(const std::string& path) {
+    file = std::fopen(path.c_str(), "w");
+    if (!file) return false;
+    epoch = std::chrono::steady_clock::now();
+    std::fputs("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [", file);
+    return true;
+}
+
+void ChromeTrace::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    std::fputs("\n]}\n", file);
+    std::fclose(file);
+    file = nullptr;
+}
+
+void ChromeTrace::beginEvent() {
+    std::fputs(first_event ? "\n" : ",\n", file);
+    first_event = false;
+}
+
+void ChromeTrace::complete(const char* name, double start, double duration) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    beginEvent();
+    std::fprintf(file, "{\"name\": \"%s\", \"cat\": \"lox\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+                       "\"pid\": %d, \"tid\": %ld}",
+                 name, start, duration, static_cast<int>(getpid()), thread_id());
+}
+
+void ChromeTrace::instant(const char* name, const char* arg_name, int64_t arg_value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!file) return;
+    beginEvent();
+    std::fprintf(file, "{\"name\": \"%s\", \"cat\": \"lox\", \"ph\": \"i\", \"s\": \"t\", \"ts\": %.3f, "
+                       "\"pid\": %d, \"tid\": %ld, \"args\": {\"%s\": %lld}}",
+                 name, now(), static_cast<int>(getpid()), thread_id(), arg_name,
+                 static_cast<long long>(arg_value));
+}
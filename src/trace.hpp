@@ -0,0 +1,97 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+// Static tracepoints on the scanner hot paths, plus an optional Chrome
+// trace_event writer for lining phases up in Perfetto / chrome://tracing.
+//
+// The USDT probes (provider "lox") cost a single nop until a tracer such as
+// bpftrace or perf attaches to them:
+//   lox:scan_start(bytes)  lox:scan_end(tokens, line)
+//   lox:token_batch(tokens)  lox:error(line)
+// Without <sys/sdt.h>, or with LOX_NO_USDT defined, they compile to nothing
+
+#if defined(__has_include) && !defined(LOX_NO_USDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LOX_HAVE_USDT 1
+#endif
+#endif
+
+#ifdef LOX_HAVE_USDT
+#define LOX_PROBE1(name, a) DTRACE_PROBE1(lox, name, a)
+#define LOX_PROBE2(name, a, b) DTRACE_PROBE2(lox, name, a, b)
+#else
+#define LOX_PROBE1(name, a) ((void)0)
+#define LOX_PROBE2(name, a, b) ((void)0)
+#endif
+
+// Writes events in the Chrome JSON trace format. Inactive until open() is
+// called, so each hook costs one predictable branch when tracing is off
+class ChromeTrace {
+public:
+    ~ChromeTrace() { close(); }
+
+    bool open(const std::string& path);
+    void close();
+
+    bool active() const { return file != nullptr; }
+
+    // Microseconds since open(), the unit trace_event timestamps use
+    double now() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void complete(const char* name, double start, double duration);
+    void instant(const char* name, const char* arg_name, int64_t arg_value);
+
+private:
+    std::FILE* file = nullptr;
+    std::chrono::steady_clock::time_point epoch;
+    std::mutex mutex;
+    bool first_event = true;
+
+    void beginEvent();
+};
+
+extern ChromeTrace chrome_trace;
+
+// Records the enclosing scope as one complete ("X") event
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name) : name(name) {
+        if (chrome_trace.active()) start = chrome_trace.now();
+    }
+
+    ~TraceSpan() {
+        if (chrome_trace.active()) chrome_trace.complete(name, start, chrome_trace.now() - start);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    double start = 0;
+};
+
+#define LOX_TRACE_SPAN(name) TraceSpan trace_span_(name)
+
+#define LOX_TRACE_SCAN_START(bytes) LOX_PROBE1(scan_start, bytes)
+#define LOX_TRACE_SCAN_END(tokens, line) LOX_PROBE2(scan_end, tokens, line)
+
+#define LOX_TRACE_TOKEN_BATCH(tokens)                                                      \
+    do {                                                                                   \
+        LOX_PROBE1(token_batch, tokens);                                                   \
+        if (chrome_trace.active()) chrome_trace.instant("token_batch", "tokens", (tokens)); \
+    } while (0)
+
+#define LOX_TRACE_ERROR(line)                                                  \
+    do {                                                                       \
+        LOX_PROBE1(error, line);                                               \
+        if (chrome_trace.active()) chrome_trace.instant("error", "line", (line)); \
+    } while (0)
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+#include <string>
+
+struct Obj;
+class Value;
+
+// The slow path of Value equality: true if both are strings with the same
+// characters and at least one of them is a rope
+bool equal_strings(Value a, Value b);
+
+// A Lox value packed into 64 bits ("NaN boxing"). Doubles are stored as
+// themselves. Every other value hides in the payload of a quiet NaN that
+// arithmetic never produces: nil and the booleans are small tags, and heap
+// objects are a pointer with the sign bit set. Copying a Value is a single
+// register move and numeric code never touches a type tag
+class Value {
+public:
+    constexpr Value() : bits(NIL_BITS) {}
+
+    static Value number(double value) { return Value(std::bit_cast<uint64_t>(value)); }
+    static constexpr Value nil() { return Value(NIL_BITS); }
+    static constexpr Value boolean(bool value) { return Value(value ? TRUE_BITS : FALSE_BITS); }
+    static Value object(Obj* object) {
+        return Value(SIGN_BIT | QNAN | static_cast<uint64_t>(reinterpret_cast<uintptr_t>(object)));
+    }
+
+    // Marks a global slot nothing has been assigned to yet. Never visible
+    // to Lox code: reading such a slot is an "Undefined variable" error
+    static constexpr Value undefined() { return Value(UNDEFINED_BITS); }
+    bool isUndefined() const { return bits == UNDEFINED_BITS; }
+
+    bool isNumber() const { return (bits & QNAN) != QNAN; }
+    bool isNil() const { return bits == NIL_BITS; }
+    bool isBool() const { return (bits | 1) == TRUE_BITS; }
+    bool isObject() const { return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+
+    double asNumber() const { return std::bit_cast<double>(bits); }
+    bool asBool() const { return bits == TRUE_BITS; }
+    Obj* asObject() const { return reinterpret_cast<Obj*>(static_cast<uintptr_t>(bits & ~(SIGN_BIT | QNAN))); }
+
+    // nil and false are falsey, everything else is truthy
+    bool isFalsey() const { return isNil() || bits == FALSE_BITS; }
+
+    uint64_t raw() const { return bits; }
+    static Value fromRaw(uint64_t bits) { return Value(bits); }
+
+    // Lox equality. Flat strings are interned, so comparing the bits
+    // compares them too; only a rope has to be compared by its characters.
+    // Numbers go through double comparison so NaN != NaN
+    friend bool operator==(Value a, Value b) {
+        if (a.isNumber() && b.isNumber()) return a.asNumber() == b.asNumber();
+        if (a.bits == b.bits) return true;
+        return a.isObject() && b.isObject() && equal_strings(a, b);
+    }
+
+private:
+    static constexpr uint64_t SIGN_BIT = 0x8000000000000000;
+    static constexpr uint64_t QNAN = 0x7ffc000000000000;
+    static constexpr uint64_t NIL_BITS = QNAN | 1;
+    static constexpr uint64_t FALSE_BITS = QNAN | 2;
+    static constexpr uint64_t TRUE_BITS = QNAN | 3;
+    static constexpr uint64_t UNDEFINED_BITS = QNAN | 4;
+
+    uint64_t bits;
+
+    explicit constexpr Value(uint64_t bits) : bits(bits) {}
+};
+
+static_assert(sizeof(Value) == 8, "a Value must stay one machine word");
+
+// Numbers print in their shortest round-tripping form, without a trailing
+// ".0" for integers: 3, 2.5, 1e+21
+std::string format_number(double value);
+
+// How `print` shows a value
+std::string stringify(Value value);
@@ -0,0 +1,829 @@
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "error.hpp"
+#include "natives.hpp"
+#include "stats.hpp"
+
+// Labels as values are a GCC/Clang extension; anything else gets the switch
+#if defined(LOX_COMPUTED_GOTO) && defined(__GNUC__)
+#define LOX_USE_COMPUTED_GOTO
+#endif
+
+namespace {
+
+void write_line(const std::string& text) {
+    std::fwrite(text.data(), 1, text.size(), stdout);
+    std::fputc('\n', stdout);
+}
+
+void cache_miss(PropertyCache& cache, const PropertyCache::Entry& entry) {
+    LOX_STATS_ADD(ic_misses, 1);
+    if (cache.add(entry)) LOX_STATS_ADD(ic_megamorphic, 1);
+}
+
+}
+
+VM::VM() : stack(new Value[STACK_MAX]) {
+    stackTop = stack.get();
+    heap.addRoots(this);
+    initString = heap.copyString("init");
+}
+
+VM::~VM() {
+    heap.removeRoots(this);
+}
+
+void VM::markRoots(Heap& heap) {
+    for (Value* slot = stack.get(); slot < stackTop; slot++) {
+        heap.markValue(*slot);
+    }
+    for (int i = 0; i < frameCount; i++) {
+        heap.markObject(frames[i].function);
+        heap.markObject(frames[i].closure);
+    }
+    for (ObjUpvalue* upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextOpen) {
+        heap.markObject(upvalue);
+    }
+    for (Value global : globals) {
+        heap.markValue(global);
+    }
+    for (ObjString* name : globalNames) {
+        heap.markObject(name);
+    }
+    heap.markObject(initString);
+}
+
+bool VM::run(ObjFunction* script, std::span<ObjString* const> names) {
+    globalNames = names;
+    globals.assign(names.size(), Value::undefined());
+    uint16_t index = 0;
+    for (const NativeDef& native : natives()) {
+        globals[index] = Value::object(heap.make<ObjNative>(native.function, native.arity, names[index]));
+        index++;
+    }
+
+    push(Value::object(script));
+    call(script, nullptr, 0);
+
+    bool ok = opcodePairs.empty() ? execute<false>() : execute<true>();
+    std::fflush(stdout);
+    return ok;
+}
+
+// The instruction pointer and the current frame's constants are kept in
+// locals so the compiler can hold them in registers; frame->ip is only
+// written back when something else needs to see it (calls, errors, and
+// allocations, which the heap profiler charges to the current line)
+template <bool COUNT_PAIRS>
+bool VM::execute() {
+    CallFrame* frame;
+    uint8_t* ip;
+    const Value* constants;
+    PropertyCache* caches;
+    [[maybe_unused]] size_t previousOp = OPCODE_COUNT;  // none yet
+
+#define LOAD_FRAME()                                              \
+    do {                                                          \
+        frame = &frames[frameCount - 1];                          \
+        ip = frame->ip;                                           \
+        constants = frame->function->chunk.constants.data();      \
+        caches = frame->function->chunk.caches.data();            \
+    } while (false)
+#define READ_BYTE() (*ip++)
+#define READ_SHORT() (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define READ_CONSTANT() (constants[READ_SHORT()])
+#define READ_STRING() as_string(READ_CONSTANT())
+#define RUNTIME_ERROR(message)      \
+    do {                            \
+        frame->ip = ip;             \
+        runtimeError(message);      \
+        return false;               \
+    } while (false)
+#define NUMBER_OPERANDS()                                             \
+    do {                                                              \
+        if (!peek(0).isNumber() || !peek(1).isNumber()) {             \
+            RUNTIME_ERROR("Operands must be numbers.");               \
+        }                                                             \
+    } while (false)
+// Stores to an existing field, and ones adding a field that fits in the
+// instance's inline slots, are done here; anything else (growing the
+// overflow slots, a shape the cache hasn't seen) goes the long way. Leaves
+// the instance and value on the stack
+#define STORE_PROPERTY()                                                                                  \
+    do {                                                                                                  \
+        if (!is_obj_type(peek(1), ObjType::INSTANCE)) {                                                   \
+            RUNTIME_ERROR("Only instances have fields.");                                                 \
+        }                                                                                                 \
+        auto* instance = static_cast<ObjInstance*>(peek(1).asObject());                                   \
+        ObjString* name = READ_STRING();                                                                  \
+        PropertyCache& cache = caches[READ_SHORT()];                                                      \
+        const PropertyCache::Entry* entry = cache.find(instance->shape);                                  \
+        if (entry != nullptr && (entry->next == entry->shape || entry->slot < instance->inlineCapacity)) { \
+            instance->slot(entry->slot) = peek(0);                                                        \
+            instance->shape = entry->next;                                                                \
+        }                                                                                                 \
+        else {                                                                                            \
+            frame->ip = ip;                                                                               \
+            setProperty(instance, name, cache);                                                           \
+        }                                                                                                 \
+    } while (false)
+// `+` on whatever the operands turn out to be
+#define GENERIC_ADD()                                                                     \
+    do {                                                                                  \
+        Value b = peek(0);                                                                \
+        Value a = peek(1);                                                                \
+        if (a.isNumber() && b.isNumber()) {                                               \
+            stackTop[-2] = Value::number(a.asNumber() + b.asNumber());                    \
+        }                                                                                 \
+        else if (is_string(a) && is_string(b)) {                                          \
+            /* Both operands stay on the stack until the result exists */                 \
+            frame->ip = ip;                                                               \
+            stackTop[-2] = Value::object(heap.concatenate(a.asObject(), b.asObject()));   \
+        }                                                                                 \
+        else {                                                                            \
+            RUNTIME_ERROR("Operands must be two numbers or two strings.");                \
+        }                                                                                 \
+        stackTop--;                                                                       \
+    } while (false)
+// Pops both operands and jumps if the comparison is false, without ever
+// pushing the bool
+#define COMPARE_JUMP(op)                                               \
+    do {                                                               \
+        NUMBER_OPERANDS();                                             \
+        bool holds = stackTop[-2].asNumber() op stackTop[-1].asNumber(); \
+        stackTop -= 2;                                                 \
+        uint16_t offset = READ_SHORT();                                \
+        if (!holds) ip += offset;                                      \
+    } while (false)
+#define BINARY_OP(wrap, op)                                                              \
+    do {                                                                                 \
+        NUMBER_OPERANDS();                                                               \
+        stackTop[-2] = Value::wrap(stackTop[-2].asNumber() op stackTop[-1].asNumber());  \
+        stackTop--;                                                                      \
+    } while (false)
+
+#define COUNT_PAIR()                                                   \
+    do {                                                               \
+        if constexpr (COUNT_PAIRS) {                                   \
+            if (previousOp < OPCODE_COUNT) {                           \
+                opcodePairs[previousOp * OPCODE_COUNT + *ip]++;        \
+            }                                                          \
+            previousOp = *ip;                                          \
+        }                                                              \
+    } while (false)
+
+#ifdef LOX_USE_COMPUTED_GOTO
+    static void* const dispatchTable[] = {
+#define LOX_OPCODE_LABEL(name) &&op_##name,
+        LOX_OPCODES(LOX_OPCODE_LABEL)
+#undef LOX_OPCODE_LABEL
+    };
+#define DISPATCH()                          \
+    do {                                    \
+        COUNT_PAIR();                       \
+        goto *dispatchTable[READ_BYTE()];   \
+    } while (false)
+#define TARGET(name) op_##name
+#else
+#define DISPATCH() continue
+#define TARGET(name) case OpCode::name
+#endif
+
+    LOAD_FRAME();
+
+#ifdef LOX_USE_COMPUTED_GOTO
+    DISPATCH();
+#else
+    for (;;) {
+        COUNT_PAIR();
+        switch (static_cast<OpCode>(READ_BYTE())) {
+#endif
+
+    TARGET(CONSTANT):
+        push(READ_CONSTANT());
+        DISPATCH();
+
+    TARGET(NIL):
+        push(Value::nil());
+        DISPATCH();
+
+    TARGET(TRUE):
+        push(Value::boolean(true));
+        DISPATCH();
+
+    TARGET(FALSE):
+        push(Value::boolean(false));
+        DISPATCH();
+
+    TARGET(POP):
+        stackTop--;
+        DISPATCH();
+
+    TARGET(GET_LOCAL):
+        push(frame->slots[READ_BYTE()]);
+        DISPATCH();
+
+    TARGET(SET_LOCAL):
+        frame->slots[READ_BYTE()] = peek(0);
+        DISPATCH();
+
+    TARGET(GET_GLOBAL): {
+        uint16_t index = READ_SHORT();
+        Value value = globals[index];
+        if (value.isUndefined()) {
+            RUNTIME_ERROR("Undefined variable '" + std::string(globalNames[index]->view()) + "'.");
+        }
+        push(value);
+        DISPATCH();
+    }
+
+    TARGET(DEFINE_GLOBAL):
+        globals[READ_SHORT()] = peek(0);
+        stackTop--;
+        DISPATCH();
+
+    TARGET(SET_GLOBAL): {
+        uint16_t index = READ_SHORT();
+        if (globals[index].isUndefined()) {
+            RUNTIME_ERROR("Undefined variable '" + std::string(globalNames[index]->view()) + "'.");
+        }
+        globals[index] = peek(0);
+        DISPATCH();
+    }
+
+    TARGET(GET_UPVALUE):
+        push(*frame->closure->upvalues()[READ_BYTE()]->location);
+        DISPATCH();
+
+    TARGET(SET_UPVALUE):
+        *frame->closure->upvalues()[READ_BYTE()]->location = peek(0);
+        DISPATCH();
+
+    TARGET(GET_PROPERTY): {
+        if (!is_obj_type(peek(0), ObjType::INSTANCE)) {
+            RUNTIME_ERROR("Only instances have properties.");
+        }
+        auto* instance = static_cast<ObjInstance*>(peek(0).asObject());
+        ObjString* name = READ_STRING();
+        PropertyCache& cache = caches[READ_SHORT()];
+
+        if (const PropertyCache::Entry* entry = cache.find(instance->shape)) {
+            if (entry->method == nullptr) {
+                stackTop[-1] = instance->slot(entry->slot);
+                DISPATCH();
+            }
+            frame->ip = ip;
+            auto* bound = heap.make<ObjBoundMethod>(peek(0), entry->method);
+            stackTop[-1] = Value::object(bound);
+            DISPATCH();
+        }
+        frame->ip = ip;
+        if (!getProperty(instance, name, cache)) return false;
+        DISPATCH();
+    }
+
+    TARGET(SET_PROPERTY):
+        STORE_PROPERTY();
+        stackTop[-2] = stackTop[-1];
+        stackTop--;
+        DISPATCH();
+
+    TARGET(GET_SUPER): {
+        ObjString* name = READ_STRING();
+        auto* superclass = static_cast<ObjClass*>(pop().asObject());
+        frame->ip = ip;
+        if (!bindMethod(superclass, name)) return false;
+        DISPATCH();
+    }
+
+    TARGET(EQUAL):
+        stackTop[-2] = Value::boolean(stackTop[-2] == stackTop[-1]);
+        stackTop--;
+        DISPATCH();
+
+    TARGET(NOT_EQUAL):
+        stackTop[-2] = Value::boolean(!(stackTop[-2] == stackTop[-1]));
+        stackTop--;
+        DISPATCH();
+
+    TARGET(GREATER):
+        BINARY_OP(boolean, >);
+        DISPATCH();
+
+    TARGET(GREATER_EQUAL):
+        BINARY_OP(boolean, >=);
+        DISPATCH();
+
+    TARGET(LESS):
+        BINARY_OP(boolean, <);
+        DISPATCH();
+
+    TARGET(LESS_EQUAL):
+        BINARY_OP(boolean, <=);
+        DISPATCH();
+
+    // The first time an ADD runs it rewrites itself in place for the
+    // operands it sees, so later runs test only for that case. Mixed
+    // operands are an error, so those are left as they are
+    TARGET(ADD): {
+        Value b = peek(0);
+        Value a = peek(1);
+        if (a.isNumber() && b.isNumber()) {
+            ip[-1] = static_cast<uint8_t>(OpCode::ADD_NUM);
+            LOX_STATS_ADD(quickened, 1);
+        }
+        else if (is_string(a) && is_string(b)) {
+            ip[-1] = static_cast<uint8_t>(OpCode::ADD_STR);
+            LOX_STATS_ADD(quickened, 1);
+        }
+        GENERIC_ADD();
+        DISPATCH();
+    }
+
+    // A specialized ADD that sees other operands becomes ADD_ANY for good,
+    // so a site that mixes numbers and strings doesn't keep rewriting itself
+    TARGET(ADD_NUM):
+        if (!peek(0).isNumber() || !peek(1).isNumber()) {
+            ip[-1] = static_cast<uint8_t>(OpCode::ADD_ANY);
+            LOX_STATS_ADD(deoptimized, 1);
+            GENERIC_ADD();
+            DISPATCH();
+        }
+        stackTop[-2] = Value::number(stackTop[-2].asNumber() + stackTop[-1].asNumber());
+        stackTop--;
+        DISPATCH();
+
+    TARGET(ADD_STR):
+        if (!is_string(peek(0)) || !is_string(peek(1))) {
+            ip[-1] = static_cast<uint8_t>(OpCode::ADD_ANY);
+            LOX_STATS_ADD(deoptimized, 1);
+            GENERIC_ADD();
+            DISPATCH();
+        }
+        frame->ip = ip;
+        stackTop[-2] = Value::object(heap.concatenate(stackTop[-2].asObject(), stackTop[-1].asObject()));
+        stackTop--;
+        DISPATCH();
+
+    TARGET(ADD_ANY):
+        GENERIC_ADD();
+        DISPATCH();
+
+    TARGET(SUBTRACT):
+        BINARY_OP(number, -);
+        DISPATCH();
+
+    TARGET(MULTIPLY):
+        BINARY_OP(number, *);
+        DISPATCH();
+
+    TARGET(DIVIDE):
+        BINARY_OP(number, /);
+        DISPATCH();
+
+    TARGET(NOT):
+        stackTop[-1] = Value::boolean(stackTop[-1].isFalsey());
+        DISPATCH();
+
+    TARGET(NEGATE):
+        if (!peek(0).isNumber()) {
+            RUNTIME_ERROR("Operand must be a number.");
+        }
+        stackTop[-1] = Value::number(-stackTop[-1].asNumber());
+        DISPATCH();
+
+    TARGET(PRINT):
+        write_line(stringify(pop()));
+        DISPATCH();
+
+    TARGET(JUMP): {
+        uint16_t offset = READ_SHORT();
+        ip += offset;
+        DISPATCH();
+    }
+
+    TARGET(JUMP_IF_FALSE): {
+        uint16_t offset = READ_SHORT();
+        if (peek(0).isFalsey()) ip += offset;
+        DISPATCH();
+    }
+
+    TARGET(LOOP): {
+        uint16_t offset = READ_SHORT();
+        ip -= offset;
+        DISPATCH();
+    }
+
+    TARGET(CALL): {
+        int argCount = READ_BYTE();
+        frame->ip = ip;
+        if (!callValue(peek(argCount), argCount)) return false;
+        LOAD_FRAME();
+        DISPATCH();
+    }
+
+    TARGET(INVOKE): {
+        ObjString* method = READ_STRING();
+        int argCount = READ_BYTE();
+        PropertyCache& cache = caches[READ_SHORT()];
+        frame->ip = ip;
+
+        Value receiver = peek(argCount);
+        const PropertyCache::Entry* entry = nullptr;
+        if (is_obj_type(receiver, ObjType::INSTANCE)) {
+            entry = cache.find(static_cast<ObjInstance*>(receiver.asObject())->shape);
+        }
+        if (entry != nullptr && entry->method != nullptr) {
+            if (!call(entry->method, argCount)) return false;
+        }
+        else if (!invoke(method, argCount, cache)) {
+            return false;
+        }
+        LOAD_FRAME();
+        DISPATCH();
+    }
+
+    TARGET(SUPER_INVOKE): {
+        ObjString* method = READ_STRING();
+        int argCount = READ_BYTE();
+        auto* superclass = static_cast<ObjClass*>(pop().asObject());
+        frame->ip = ip;
+        if (!invokeFromClass(superclass, method, argCount)) return false;
+        LOAD_FRAME();
+        DISPATCH();
+    }
+
+    TARGET(CLOSURE): {
+        auto* function = static_cast<ObjFunction*>(READ_CONSTANT().asObject());
+        frame->ip = ip;
+        ObjClosure* closure = heap.makeClosure(function);
+        push(Value::object(closure));
+        for (int i = 0; i < function->upvalueCount; i++) {
+            uint8_t isLocal = READ_BYTE();
+            uint8_t index = READ_BYTE();
+            closure->upvalues()[i] = isLocal ? captureUpvalue(frame->slots + index)
+                                             : frame->closure->upvalues()[index];
+        }
+        DISPATCH();
+    }
+
+    TARGET(CLOSE_UPVALUE):
+        closeUpvalues(stackTop - 1);
+        stackTop--;
+        DISPATCH();
+
+    TARGET(RETURN): {
+        Value result = pop();
+        closeUpvalues(frame->slots);
+        frameCount--;
+        if (frameCount == 0) {
+            stackTop = stack.get();
+            return true;
+        }
+
+        stackTop = frame->slots;
+        push(result);
+        LOAD_FRAME();
+        DISPATCH();
+    }
+
+    TARGET(CLASS):
+        frame->ip = ip;
+        push(Value::object(heap.make<ObjClass>(READ_STRING())));
+        DISPATCH();
+
+    TARGET(INHERIT): {
+        Value superclass = peek(1);
+        if (!is_obj_type(superclass, ObjType::CLASS)) {
+            RUNTIME_ERROR("Superclass must be a class.");
+        }
+        // Methods are copied down at class creation, so lookups never walk
+        // the inheritance chain. The subclass's own METHODs come after and
+        // override them
+        auto* subclass = static_cast<ObjClass*>(peek(0).asObject());
+        subclass->superclass = static_cast<ObjClass*>(superclass.asObject());
+        subclass->methods.addAll(subclass->superclass->methods);
+        stackTop--;
+        DISPATCH();
+    }
+
+    TARGET(METHOD):
+        defineMethod(READ_STRING());
+        DISPATCH();
+
+    TARGET(GET_LOCAL_2):
+        push(frame->slots[ip[0]]);
+        push(frame->slots[ip[1]]);
+        ip += 2;
+        DISPATCH();
+
+    TARGET(GET_LOCAL_CONSTANT):
+        push(frame->slots[READ_BYTE()]);
+        push(READ_CONSTANT());
+        DISPATCH();
+
+    TARGET(SET_LOCAL_POP):
+        frame->slots[READ_BYTE()] = pop();
+        DISPATCH();
+
+    TARGET(SET_PROPERTY_POP):
+        STORE_PROPERTY();
+        stackTop -= 2;
+        DISPATCH();
+
+    // `i = i + k;`: the same as ADD, with the local and the constant as
+    // operands, both of which keep the operands reachable while
+    // concatenating
+    TARGET(ADD_CONSTANT_TO_LOCAL): {
+        Value* local = &frame->slots[READ_BYTE()];
+        Value b = READ_CONSTANT();
+        Value a = *local;
+        if (a.isNumber() && b.isNumber()) {
+            *local = Value::number(a.asNumber() + b.asNumber());
+        }
+        else if (is_string(a) && is_string(b)) {
+            frame->ip = ip;
+            *local = Value::object(heap.concatenate(a.asObject(), b.asObject()));
+        }
+        else {
+            RUNTIME_ERROR("Operands must be two numbers or two strings.");
+        }
+        DISPATCH();
+    }
+
+    TARGET(POP_JUMP_IF_FALSE): {
+        uint16_t offset = READ_SHORT();
+        if (pop().isFalsey()) ip += offset;
+        DISPATCH();
+    }
+
+    TARGET(LESS_JUMP_IF_FALSE):
+        COMPARE_JUMP(<);
+        DISPATCH();
+
+    TARGET(LESS_EQUAL_JUMP_IF_FALSE):
+        COMPARE_JUMP(<=);
+        DISPATCH();
+
+    TARGET(GREATER_JUMP_IF_FALSE):
+        COMPARE_JUMP(>);
+        DISPATCH();
+
+    TARGET(GREATER_EQUAL_JUMP_IF_FALSE):
+        COMPARE_JUMP(>=);
+        DISPATCH();
+
+#ifndef LOX_USE_COMPUTED_GOTO
+        }
+    }
+#endif
+
+#undef LOAD_FRAME
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_CONSTANT
+#undef READ_STRING
+#undef RUNTIME_ERROR
+#undef NUMBER_OPERANDS
+#undef BINARY_OP
+#undef STORE_PROPERTY
+#undef GENERIC_ADD
+#undef COMPARE_JUMP
+#undef COUNT_PAIR
+#undef DISPATCH
+#undef TARGET
+}
+
+bool VM::writeOpcodePairs(const std::string& path) const {
+    struct Pair {
+        uint64_t count;
+        size_t first;
+        size_t second;
+    };
+    std::vector<Pair> pairs;
+    uint64_t total = 0;
+    for (size_t i = 0; i < opcodePairs.size(); i++) {
+        if (opcodePairs[i] == 0) continue;
+        pairs.push_back({opcodePairs[i], i / OPCODE_COUNT, i % OPCODE_COUNT});
+        total += opcodePairs[i];
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const Pair& a, const Pair& b) { return a.count > b.count; });
+
+    std::FILE* out = path.empty() ? stderr : std::fopen(path.c_str(), "w");
+    if (!out) return false;
+    std::fprintf(out, "%14s %7s  %s\n", "count", "share", "pair");
+    for (const Pair& pair : pairs) {
+        std::fprintf(out, "%14llu %6.2f%%  %s %s\n", static_cast<unsigned long long>(pair.count),
+                     100.0 * pair.count / total, opcode_name(static_cast<OpCode>(pair.first)),
+                     opcode_name(static_cast<OpCode>(pair.second)));
+    }
+    return path.empty() || std::fclose(out) == 0;
+}
+
+bool VM::callValue(Value callee, int argCount) {
+    if (callee.isObject()) {
+        switch (callee.asObject()->type) {
+            case ObjType::FUNCTION:
+            case ObjType::CLOSURE:
+                return call(callee.asObject(), argCount);
+
+            case ObjType::NATIVE: {
+                auto* native = static_cast<ObjNative*>(callee.asObject());
+                if (argCount != native->arity) {
+                    runtimeError("Expected " + std::to_string(native->arity) + " arguments but got " +
+                                 std::to_string(argCount) + ".");
+                    return false;
+                }
+                Value result = native->function(argCount, stackTop - argCount);
+                stackTop -= argCount + 1;
+                push(result);
+                return true;
+            }
+
+            case ObjType::CLASS: {
+                auto* klass = static_cast<ObjClass*>(callee.asObject());
+                stackTop[-argCount - 1] = Value::object(heap.makeInstance(klass));
+                if (const Value* initializer = klass->methods.find(initString)) {
+                    return call(initializer->asObject(), argCount);
+                }
+                if (argCount != 0) {
+                    runtimeError("Expected 0 arguments but got " + std::to_string(argCount) + ".");
+                    return false;
+                }
+                return true;
+            }
+
+            case ObjType::BOUND_METHOD: {
+                auto* bound = static_cast<ObjBoundMethod*>(callee.asObject());
+                stackTop[-argCount - 1] = bound->receiver;
+                return call(bound->method, argCount);
+            }
+
+            default:
+                break;
+        }
+    }
+    runtimeError("Can only call functions and classes.");
+    return false;
+}
+
+bool VM::call(Obj* callee, int argCount) {
+    if (callee->type == ObjType::FUNCTION) {
+        return call(static_cast<ObjFunction*>(callee), nullptr, argCount);
+    }
+    auto* closure = static_cast<ObjClosure*>(callee);
+    return call(closure->function, closure, argCount);
+}
+
+bool VM::call(ObjFunction* function, ObjClosure* closure, int argCount) {
+    if (argCount != function->arity) {
+        runtimeError("Expected " + std::to_string(function->arity) + " arguments but got " +
+                     std::to_string(argCount) + ".");
+        return false;
+    }
+    if (frameCount == FRAMES_MAX) {
+        runtimeError("Stack overflow.");
+        return false;
+    }
+
+    CallFrame& frame = frames[frameCount++];
+    frame.function = function;
+    frame.closure = closure;
+    frame.ip = function->chunk.code.data();
+    frame.slots = stackTop - argCount - 1;
+    return true;
+}
+
+// The slow paths of the cached instructions: a full lookup, remembered in
+// the instruction's cache for next time
+
+bool VM::getProperty(ObjInstance* instance, ObjString* name, PropertyCache& cache) {
+    ObjShape* shape = instance->shape;
+    int32_t slot = shape->slotOf(name);
+    if (slot >= 0) {
+        cache_miss(cache, {shape, nullptr, nullptr, static_cast<uint32_t>(slot)});
+        stackTop[-1] = instance->slot(static_cast<uint32_t>(slot));
+        return true;
+    }
+
+    if (!bindMethod(instance->klass, name)) return false;
+    cache_miss(cache, {shape, nullptr, static_cast<ObjBoundMethod*>(peek(0).asObject())->method, 0});
+    return true;
+}
+
+void VM::setProperty(ObjInstance* instance, ObjString* name, PropertyCache& cache) {
+    // The old shape stays reachable from the class's root shape
+    ObjShape* shape = instance->shape;
+    heap.setField(instance, name, peek(0));
+    uint32_t slot = static_cast<uint32_t>(instance->shape->slotOf(name));
+    cache_miss(cache, {shape, instance->shape, nullptr, slot});
+}
+
+bool VM::invoke(ObjString* name, int argCount, PropertyCache& cache) {
+    Value receiver = peek(argCount);
+    if (!is_obj_type(receiver, ObjType::INSTANCE)) {
+        runtimeError("Only instances have methods.");
+        return false;
+    }
+
+    // A field holding something callable is called as it is; those aren't
+    // cached, since the value can change under the same shape
+    auto* instance = static_cast<ObjInstance*>(receiver.asObject());
+    if (const Value* field = instance->field(name)) {
+        stackTop[-argCount - 1] = *field;
+        return callValue(*field, argCount);
+    }
+
+    const Value* method = instance->klass->methods.find(name);
+    if (method == nullptr) {
+        runtimeError("Undefined property '" + std::string(name->view()) + "'.");
+        return false;
+    }
+    cache_miss(cache, {instance->shape, nullptr, method->asObject(), 0});
+    return call(method->asObject(), argCount);
+}
+
+bool VM::invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
+    const Value* method = klass->methods.find(name);
+    if (method == nullptr) {
+        runtimeError("Undefined property '" + std::string(name->view()) + "'.");
+        return false;
+    }
+    return call(method->asObject(), argCount);
+}
+
+// Replaces the receiver on top of the stack with the named method bound to it
+bool VM::bindMethod(ObjClass* klass, ObjString* name) {
+    const Value* method = klass->methods.find(name);
+    if (method == nullptr) {
+        runtimeError("Undefined property '" + std::string(name->view()) + "'.");
+        return false;
+    }
+
+    auto* bound = heap.make<ObjBoundMethod>(peek(0), method->asObject());
+    stackTop[-1] = Value::object(bound);
+    return true;
+}
+
+// Closures capturing the same variable must share one upvalue, so the open
+// list is searched first. It is sorted by slot, innermost first
+ObjUpvalue* VM::captureUpvalue(Value* local) {
+    ObjUpvalue* previous = nullptr;
+    ObjUpvalue* upvalue = openUpvalues;
+    while (upvalue != nullptr && upvalue->location > local) {
+        previous = upvalue;
+        upvalue = upvalue->nextOpen;
+    }
+    if (upvalue != nullptr && upvalue->location == local) return upvalue;
+
+    auto* created = heap.make<ObjUpvalue>(local);
+    created->nextOpen = upvalue;
+    if (previous == nullptr) {
+        openUpvalues = created;
+    }
+    else {
+        previous->nextOpen = created;
+    }
+    return created;
+}
+
+// Moves every open upvalue at or above `last` off the stack
+void VM::closeUpvalues(Value* last) {
+    while (openUpvalues != nullptr && openUpvalues->location >= last) {
+        ObjUpvalue* upvalue = openUpvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        openUpvalues = upvalue->nextOpen;
+    }
+}
+
+void VM::defineMethod(ObjString* name) {
+    Value method = peek(0);
+    auto* klass = static_cast<ObjClass*>(peek(1).asObject());
+    klass->methods.set(name, method);
+    stackTop--;
+}
+
+int VM::currentLine() const {
+    if (frameCount == 0) return 0;
+    const CallFrame& frame = frames[frameCount - 1];
+    const Chunk& chunk = frame.function->chunk;
+    if (frame.ip == chunk.code.data()) return 0;
+    return chunk.lines[frame.ip - chunk.code.data() - 1];
+}
+
+void VM::runtimeError(const std::string& message) {
+    const CallFrame& frame = frames[frameCount - 1];
+    const Chunk& chunk = frame.function->chunk;
+    size_t instruction = frame.ip - chunk.code.data() - 1;
+
+    std::fflush(stdout);
+    runtime_error(chunk.lines[instruction], message);
+
+    stackTop = stack.get();
+    frameCount = 0;
+    openUpvalues = nullptr;
+}
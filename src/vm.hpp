@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+#include "object.hpp"
+#include "value.hpp"
+
+// Stack-based bytecode interpreter for the `run --engine=vm` engine. The
+// dispatch loop uses computed goto where the compiler supports labels as
+// values (LOX_COMPUTED_GOTO) and a plain switch everywhere else
+class VM : public GcRoots {
+public:
+    VM();
+    ~VM();
+
+    VM(const VM&) = delete;
+    VM& operator=(const VM&) = delete;
+
+    // Runs a compiled script whose globals are numbered as in `globalNames`
+    // (see Compiler::globalNames). Returns false after reporting a runtime
+    // error
+    bool run(ObjFunction* script, std::span<ObjString* const> globalNames);
+
+    // Line of the instruction last executed, for the heap profiler. Only
+    // exact when called from an instruction that allocates
+    int currentLine() const;
+
+    // Makes run() count how often each opcode is executed right after each
+    // other one (`run --dump-opcode-pairs`), the profile superinstructions
+    // are chosen from. Counting runs in its own copy of the dispatch loop,
+    // so the normal one pays nothing for it
+    void countOpcodePairs() { opcodePairs.assign(OPCODE_COUNT * OPCODE_COUNT, 0); }
+    // Writes the pairs counted, most frequent first, to `path`, or to
+    // stderr if it is empty. Returns false if the file can't be written
+    bool writeOpcodePairs(const std::string& path) const;
+
+private:
+    // A function the compiler loads as a constant is called as it is,
+    // without an ObjClosure, so `closure` is only set for one called
+    // through a closure
+    struct CallFrame {
+        ObjFunction* function;
+        ObjClosure* closure;
+        uint8_t* ip;
+        Value* slots;       // the callee's slot; arguments and locals follow
+    };
+
+    static constexpr int FRAMES_MAX = 2048;
+    static constexpr int STACK_MAX = FRAMES_MAX * 256;
+
+    std::unique_ptr<Value[]> stack;
+    Value* stackTop;
+    CallFrame frames[FRAMES_MAX];
+    int frameCount = 0;
+
+    // Indexed like the compiler's global names; Value::undefined() until
+    // the global is defined
+    std::vector<Value> globals;
+    std::span<ObjString* const> globalNames;
+    ObjUpvalue* openUpvalues = nullptr;
+    ObjString* initString = nullptr;
+    // first * OPCODE_COUNT + second; empty unless counting
+    std::vector<uint64_t> opcodePairs;
+
+    template <bool COUNT_PAIRS>
+    bool execute();
+    void markRoots(Heap& heap) override;
+
+    void push(Value value) { *stackTop++ = value; }
+    Value pop() { return *--stackTop; }
+    Value peek(int distance) const { return stackTop[-1 - distance]; }
+
+    bool callValue(Value callee, int argCount);
+    // Calls a function or closure, such as a method
+    bool call(Obj* callee, int argCount);
+    bool call(ObjFunction* function, ObjClosure* closure, int argCount);
+    bool getProperty(ObjInstance* instance, ObjString* name, PropertyCache& cache);
+    void setProperty(ObjInstance* instance, ObjString* name, PropertyCache& cache);
+    bool invoke(ObjString* name, int argCount, PropertyCache& cache);
+    bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount);
+    bool bindMethod(ObjClass* klass, ObjString* name);
+    ObjUpvalue* captureUpvalue(Value* local);
+    void closeUpvalues(Value* last);
+    void defineMethod(ObjString* name);
+
+    // Reports against the line of the instruction being executed
+    void runtimeError(const std::string& message);
+};
@@ -0,0 +1,254 @@
+#include "watch.hpp"
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "error.hpp"
+#include "scanner.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct FileState {
+    std::vector<Token> tokens;
+    bool had_error = false;
+};
+
+bool is_lox_file(const fs::path& path) {
+    return path.extension() == ".lox";
+}
+
+// True for `dir` itself and anything below it
+bool is_under(const fs::path& path, const fs::path& dir) {
+    return std::mismatch(dir.begin(), dir.end(), path.begin(), path.end()).first == dir.end();
+}
+
+// Unlike read_file_contents, a missing file is not fatal here: editors
+// routinely delete and recreate files while saving
+bool try_read_file(const fs::path& path, std::string& contents) {
+    std::ifstream file(path);
+    if (!file.is_open()) return false;
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+FileState scan_file(const fs::path& path) {
+    FileState state;
+    std::string contents;
+    if (!try_read_file(path, contents)) return state;
+
+    had_error = false;
+    Scanner scanner(contents);
+    state.tokens = scanner.scanTokens();
+    state.had_error = had_error;
+    return state;
+}
+
+// Lines shift whenever a newline is added above a token, so two tokens
+// count as the same if everything but the line matches
+bool same_token(const Token& a, const Token& b) {
+    return a.type == b.type && a.lexeme == b.lexeme && a.literal == b.literal;
+}
+
+// Edits on save are almost always local, so trimming the common prefix and
+// suffix is enough to isolate the changed region without a full LCS diff
+void print_diff(const std::vector<Token>& before, const std::vector<Token>& after) {
+    size_t prefix = 0;
+    while (prefix < before.size() && prefix < after.size()
+           && same_token(before[prefix], after[prefix])) {
+        prefix++;
+    }
+
+    size_t suffix = 0;
+    while (suffix < before.size() - prefix && suffix < after.size() - prefix
+           && same_token(before[before.size() - 1 - suffix], after[after.size() - 1 - suffix])) {
+        suffix++;
+    }
+
+    for (size_t i = prefix; i < before.size() - suffix; i++) {
+        std::cout << "- [line " << before[i].line << "] " << before[i] << '\n';
+    }
+    for (size_t i = prefix; i < after.size() - suffix; i++) {
+        std::cout << "+ [line " << after[i].line << "] " << after[i] << '\n';
+    }
+}
+
+class Watcher {
+public:
+    explicit Watcher(const fs::path& root) : root(root) {}
+
+    ~Watcher() {
+        if (fd >= 0) close(fd);
+    }
+
+    int run() {
+        fd = inotify_init1(IN_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "inotify_init1 failed: " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+
+        auto started = std::chrono::steady_clock::now();
+        size_t token_count = addTree(root, false);
+        std::cout << "Watching " << files.size() << " files (" << token_count << " tokens) in "
+                  << elapsedMs(started) << " ms" << std::endl;
+
+        // inotify packs several variable-length events into one read
+        alignas(inotify_event) char buffer[64 * 1024];
+        while (true) {
+            ssize_t length = read(fd, buffer, sizeof(buffer));
+            if (length < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "inotify read failed: " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+
+            for (char* p = buffer; p < buffer + length;) {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                handleEvent(*event);
+                p += sizeof(inotify_event) + event->len;
+            }
+        }
+    }
+
+private:
+    fs::path root;
+    int fd = -1;
+    std::unordered_map<int, fs::path> directories;
+    std::unordered_map<std::string, FileState> files;
+
+    static double elapsedMs(std::chrono::steady_clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+    }
+
+    // Watches `dir` and every directory below it and scans the .lox files
+    // in them, printing each as a change if `announce` is set. Returns how
+    // many tokens the files had. Directories can vanish or turn unreadable
+    // while this walks them, which only cuts the walk short
+    size_t addTree(const fs::path& dir, bool announce) {
+        size_t token_count = 0;
+        addDirectory(dir);
+        std::error_code error;
+        fs::recursive_directory_iterator entries(dir, fs::directory_options::skip_permission_denied, error);
+        for (; !error && entries != fs::recursive_directory_iterator(); entries.increment(error)) {
+            const fs::path& path = entries->path();
+            std::error_code ignored;
+            if (entries->is_directory(ignored)) {
+                addDirectory(path);
+            }
+            else if (entries->is_regular_file(ignored) && is_lox_file(path)) {
+                if (announce) rescan(path);
+                else files[path] = scan_file(path);
+                token_count += files[path].tokens.size();
+            }
+        }
+        if (error) std::cerr << "Cannot read " << dir << ": " << error.message() << std::endl;
+        return token_count;
+    }
+
+    // Forgets a directory that was moved or deleted: the watches on it and
+    // below it, which would otherwise keep reporting under the old path,
+    // and the files that were in it
+    void removeTree(const fs::path& dir) {
+        for (auto watch = directories.begin(); watch != directories.end();) {
+            if (is_under(watch->second, dir)) {
+                inotify_rm_watch(fd, watch->first);
+                watch = directories.erase(watch);
+            }
+            else {
+                ++watch;
+            }
+        }
+        for (auto file = files.begin(); file != files.end();) {
+            if (is_under(file->first, dir)) {
+                std::cout << "Removed " << file->first << std::endl;
+                file = files.erase(file);
+            }
+            else {
+                ++file;
+            }
+        }
+    }
+
+    void addDirectory(const fs::path& dir) {
+        // IN_CLOSE_WRITE rather than IN_MODIFY: a single save can fire many
+        // modify events, but closes the file only once
+        int wd = inotify_add_watch(fd, dir.c_str(),
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE);
+        if (wd < 0) {
+            std::cerr << "Cannot watch " << dir << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        directories[wd] = dir;
+    }
+
+    void handleEvent(const inotify_event& event) {
+        if (event.mask & IN_IGNORED) {
+            directories.erase(event.wd);
+            return;
+        }
+        if (event.len == 0) return;
+
+        auto dir = directories.find(event.wd);
+        if (dir == directories.end()) return;
+        fs::path path = dir->second / event.name;
+
+        // inotify is not recursive, so new subdirectories need their own
+        // watch. One moved in arrives with files and subdirectories of its
+        // own, and even a fresh one can get files before it is watched
+        if (event.mask & IN_ISDIR) {
+            if (event.mask & (IN_CREATE | IN_MOVED_TO)) addTree(path, true);
+            else if (event.mask & (IN_DELETE | IN_MOVED_FROM)) removeTree(path);
+            return;
+        }
+        if (!is_lox_file(path)) return;
+
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            if (files.erase(path) > 0) std::cout << "Removed " << path.string() << std::endl;
+            return;
+        }
+        if (event.mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+            rescan(path);
+        }
+    }
+
+    void rescan(const fs::path& path) {
+        auto started = std::chrono::steady_clock::now();
+        std::cout << "Changed " << path.string() << std::endl;
+        FileState updated = scan_file(path);
+        double elapsed = elapsedMs(started);
+
+        FileState& previous = files[path];
+        print_diff(previous.tokens, updated.tokens);
+        std::cout << updated.tokens.size() << " tokens"
+                  << (updated.had_error ? ", with errors" : "")
+                  << " (" << elapsed << " ms)" << std::endl;
+        previous = std::move(updated);
+    }
+};
+
+}
+
+int watch_directory(const std::string& dir) {
+    std::error_code error;
+    if (!fs::is_directory(dir, error)) {
+        std::cerr << "Not a directory: " << dir << std::endl;
+        return 1;
+    }
+    Watcher watcher(dir);
+    return watcher.run();
+}
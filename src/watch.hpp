@@ -0,0 +1,8 @@
+#pragma once
+
+#include <string>
+
+// Tokenizes every .lox file under `dir`, keeps the token buffers around and
+// then re-scans only the files inotify reports as changed, printing a token
+// diff for each one. Runs until interrupted; returns a process exit code.
+int watch_directory(const std::string& dir);
@@ -0,0 +1,339 @@
+// Deterministic generator of synthetic Lox source for load-testing the
+// tokenizer. The same seed and options always produce the same bytes.
+//
+// Usage: loxgen [options] > corpus.lox
+//   --seed N            RNG seed (default 1)
+//   --size BYTES        approximate output size, accepts k/m/g (default 1m)
+//   --identifiers W     relative weight of identifiers in expressions (default 6)
+//   --numbers W         relative weight of number literals (default 3)
+//   --strings W         relative weight of string literals (default 1)
+//   --vocab N           number of distinct identifiers (default 1000)
+//   --string-len N      mean string literal length (default 16)
+//   --comment-len N     mean comment length (default 30)
+//   --comment-rate P    fraction of lines ending in a comment (default 0.1)
+//   --error-rate P      fraction of statements with a stray character (default 0)
+//   -o FILE             write to FILE instead of stdout
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Options {
+    uint64_t seed = 1;
+    uint64_t size = 1 << 20;
+    unsigned identifiers = 6;
+    unsigned numbers = 3;
+    unsigned strings = 1;
+    unsigned vocab = 1000;
+    unsigned string_length = 16;
+    unsigned comment_length = 30;
+    double comment_rate = 0.1;
+    double error_rate = 0.0;
+    const char* output = nullptr;
+};
+
+// SplitMix64: tiny, fast and, unlike the std distributions, guaranteed to
+// give the same sequence on every standard library
+class Rng {
+public:
+    explicit Rng(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, bound)
+    uint64_t below(uint64_t bound) {
+        return bound == 0 ? 0 : next() % bound;
+    }
+
+    bool chance(double probability) {
+        return (next() >> 11) * 0x1.0p-53 < probability;
+    }
+
+    // Sum of two uniforms: a triangular distribution peaking at `mean`,
+    // which keeps literal lengths varied without floating point
+    uint64_t around(uint64_t mean) {
+        return 1 + below(mean + 1) + below(mean + 1) - (mean > 0 ? 1 : 0);
+    }
+
+private:
+    uint64_t state;
+};
+
+class Generator {
+public:
+    Generator(const Options& options, std::FILE* out)
+        : options(options), out(out), rng(options.seed) {
+        buffer.reserve(FLUSH_BYTES + 4096);
+        buildVocabulary();
+    }
+
+    void run() {
+        while (written + buffer.size() < options.size) {
+            statement(0);
+            if (buffer.size() >= FLUSH_BYTES) flush();
+        }
+        flush();
+    }
+
+private:
+    static constexpr size_t FLUSH_BYTES = 1 << 20;
+    static constexpr int MAX_BLOCK_DEPTH = 4;
+    static constexpr int MAX_EXPRESSION_DEPTH = 3;
+
+    const Options& options;
+    std::FILE* out;
+    Rng rng;
+    std::string buffer;
+    uint64_t written = 0;
+    std::vector<std::string> vocabulary;
+
+    void flush() {
+        std::fwrite(buffer.data(), 1, buffer.size(), out);
+        written += buffer.size();
+        buffer.clear();
+    }
+
+    void buildVocabulary() {
+        static const char* parts[] = {
+            "count", "total", "index", "node", "value", "next", "left", "right",
+            "sum", "item", "key", "name", "size", "result", "temp", "acc",
+        };
+        for (unsigned i = 0; i < options.vocab; i++) {
+            std::string name = parts[i % 16];
+            if (i >= 16) {
+                name += '_';
+                name += parts[(i / 16) % 16];
+            }
+            if (i >= 256) name += std::to_string(i / 256);
+            vocabulary.push_back(name);
+        }
+    }
+
+    // Real code reuses a few names constantly and most others rarely;
+    // nesting two uniform draws skews the pick towards low indices
+    const std::string& identifier() {
+        return vocabulary[rng.below(rng.below(vocabulary.size()) + 1)];
+    }
+
+    void indent(int depth) {
+        buffer.append(depth * 4, ' ');
+    }
+
+    void endLine() {
+        if (rng.chance(options.comment_rate)) {
+            buffer += " // ";
+            appendText(rng.around(options.comment_length));
+        }
+        buffer += '\n';
+    }
+
+    void appendText(uint64_t length) {
+        static const char letters[] = "etaoinshrdlucmfwypvbgkjqxz     ";
+        for (uint64_t i = 0; i < length; i++) {
+            buffer += letters[rng.below(sizeof(letters) - 1)];
+        }
+    }
+
+    void maybeInjectError() {
+        static const char junk[] = "@#$%^&|~`?:";
+        if (options.error_rate > 0 && rng.chance(options.error_rate)) {
+            buffer += junk[rng.below(sizeof(junk) - 1)];
+        }
+    }
+
+    void literal() {
+        unsigned total = options.identifiers + options.numbers + options.strings;
+        uint64_t pick = rng.below(total == 0 ? 1 : total);
+        if (pick < options.identifiers || total == 0) {
+            buffer += identifier();
+        }
+        else if (pick < options.identifiers + options.numbers) {
+            buffer += std::to_string(rng.below(10000));
+            if (rng.chance(0.3)) {
+                buffer += '.';
+                buffer += std::to_string(rng.below(1000));
+            }
+        }
+        else {
+            buffer += '"';
+            appendText(rng.around(options.string_length));
+            buffer += '"';
+        }
+    }
+
+    void expression(int depth) {
+        static const char* operators[] = {
+            " + ", " - ", " * ", " / ", " == ", " != ", " < ", " <= ", " > ", " >= ",
+        };
+        uint64_t shape = depth >= MAX_EXPRESSION_DEPTH ? 0 : rng.below(8);
+        switch (shape) {
+            case 0: case 1: case 2: case 3:
+                literal();
+                break;
+            case 4: case 5:
+                expression(depth + 1);
+                buffer += operators[rng.below(10)];
+                expression(depth + 1);
+                break;
+            case 6:
+                buffer += '(';
+                expression(depth + 1);
+                buffer += ')';
+                break;
+            default:
+                buffer += rng.chance(0.5) ? "-" : "!";
+                expression(depth + 1);
+                break;
+        }
+    }
+
+    void block(int depth) {
+        buffer += " {\n";
+        uint64_t count = 1 + rng.below(4);
+        for (uint64_t i = 0; i < count; i++) statement(depth + 1);
+        indent(depth);
+        buffer += '}';
+    }
+
+    void statement(int depth) {
+        indent(depth);
+        maybeInjectError();
+        uint64_t kind = depth >= MAX_BLOCK_DEPTH ? rng.below(4) : rng.below(9);
+        switch (kind) {
+            case 0:
+                buffer += "var ";
+                buffer += identifier();
+                buffer += " = ";
+                expression(0);
+                buffer += ';';
+                break;
+            case 1:
+                buffer += identifier();
+                buffer += " = ";
+                expression(0);
+                buffer += ';';
+                break;
+            case 2:
+                buffer += "print ";
+                expression(0);
+                buffer += ';';
+                break;
+            case 3:
+                buffer += identifier();
+                buffer += '(';
+                expression(1);
+                buffer += ", ";
+                expression(1);
+                buffer += ");";
+                break;
+            case 4: case 5:
+                buffer += "if (";
+                expression(0);
+                buffer += ')';
+                block(depth);
+                if (rng.chance(0.4)) {
+                    buffer += " else";
+                    block(depth);
+                }
+                break;
+            case 6:
+                buffer += "while (";
+                expression(0);
+                buffer += ')';
+                block(depth);
+                break;
+            case 7:
+                buffer += "for (var i = 0; i < ";
+                buffer += std::to_string(rng.below(100));
+                buffer += "; i = i + 1)";
+                block(depth);
+                break;
+            default:
+                buffer += "fun ";
+                buffer += identifier();
+                buffer += "(a, b)";
+                buffer += " {\n";
+                statement(depth + 1);
+                indent(depth + 1);
+                buffer += "return ";
+                expression(0);
+                buffer += ";\n";
+                indent(depth);
+                buffer += '}';
+                break;
+        }
+        endLine();
+    }
+};
+
+bool parse_size(const char* text, uint64_t& size) {
+    char* end;
+    double value = std::strtod(text, &end);
+    switch (*end) {
+        case 'k': case 'K': value *= 1 << 10; end++; break;
+        case 'm': case 'M': value *= 1 << 20; end++; break;
+        case 'g': case 'G': value *= 1 << 30; end++; break;
+    }
+    if (*end != '\0' || value < 0) return false;
+    size = static_cast<uint64_t>(value);
+    return true;
+}
+
+bool parse_options(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (i + 1 >= argc) return false;
+        const char* value = argv[++i];
+        if (!std::strcmp(arg, "--seed")) options.seed = std::strtoull(value, nullptr, 10);
+        else if (!std::strcmp(arg, "--size")) { if (!parse_size(value, options.size)) return false; }
+        else if (!std::strcmp(arg, "--identifiers")) options.identifiers = std::atoi(value);
+        else if (!std::strcmp(arg, "--numbers")) options.numbers = std::atoi(value);
+        else if (!std::strcmp(arg, "--strings")) options.strings = std::atoi(value);
+        else if (!std::strcmp(arg, "--vocab")) options.vocab = std::atoi(value);
+        else if (!std::strcmp(arg, "--string-len")) options.string_length = std::atoi(value);
+        else if (!std::strcmp(arg, "--comment-len")) options.comment_length = std::atoi(value);
+        else if (!std::strcmp(arg, "--comment-rate")) options.comment_rate = std::atof(value);
+        else if (!std::strcmp(arg, "--error-rate")) options.error_rate = std::atof(value);
+        else if (!std::strcmp(arg, "-o")) options.output = value;
+        else return false;
+    }
+    return options.vocab > 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        std::fprintf(stderr,
+            "Usage: %s [--seed N] [--size BYTES[k|m|g]] [--identifiers W] [--numbers W]\n"
+            "       [--strings W] [--vocab N] [--string-len N] [--comment-len N]\n"
+            "       [--comment-rate P] [--error-rate P] [-o FILE]\n", argv[0]);
+        return 1;
+    }
+
+    std::FILE* out = options.output ? std::fopen(options.output, "wb") : stdout;
+    if (!out) {
+        std::perror(options.output);
+        return 1;
+    }
+
+    Generator generator(options, out);
+    generator.run();
+
+    if (std::fclose(out) != 0) {
+        std::perror("write");
+        return 1;
+    }
+    return 0;
+}